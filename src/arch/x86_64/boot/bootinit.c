@@ -35,10 +35,19 @@ void enable_page(pgd_t * pgd) {
 
 // 这时操作的是临时对象，正式初始化交给 kernel_main()
 void mm_init() {
+	// CPU 支持时恒等映射与内核段都用 4MB 页，每 4MB 只需要写一个目录项
+	bool pse = cpu_has_pse();
+	if(pse) {
+		cpu_write_cr4(cpu_read_cr4() | CR4_PSE);
+	}
 	//将虚拟地址前512MB全都映射到物理内存前512MB，一一对应，为物理内存分配作准备，然后在虚拟内存分配中重新映射
 	//计算512MB需要多少个目录项
 	for(uint32_t i=0;i<PMM_MAX_SIZE/VMM_PAGE_TABLE_SIZE;i++)
 	{
+		if(pse) {
+			pgd_tmp[i] = (i * VMM_PSE_SIZE) | VMM_PAGE_PRESENT | VMM_PAGE_RW | VMM_PAGE_PSE;
+			continue;
+		}
 		for(uint32_t j =i*VMM_PAGES_PRE_PAGE_TABLE  ; j < (i+1)*VMM_PAGES_PRE_PAGE_TABLE ; j++) 
 		{
 		// 物理地址由 (i << 12) 给出
@@ -49,10 +58,22 @@ void mm_init() {
 	// init 段, 4MB
 	// 因为 mm_init 返回后仍然在 init 段，不映射的话会爆炸的
 	//pgd_tmp[0] = (ptr_t)pte_init | VMM_PAGE_PRESENT | VMM_PAGE_RW;
-	// 内核段 pgd_tmp[0x300], 4MB
-	pgd_tmp[VMM_PGD_INDEX(KERNEL_BASE)] = (ptr_t)pte_kernel_tmp | VMM_PAGE_PRESENT | VMM_PAGE_RW | VMM_PAGE_KERNEL;
-	// 内核段 pgd_tmp[0x301], 4MB
-	pgd_tmp[VMM_PGD_INDEX(KERNEL_BASE) + 1] = (ptr_t)pte_kernel_tmp2 | VMM_PAGE_PRESENT | VMM_PAGE_RW | VMM_PAGE_KERNEL;
+	if(pse) {
+		// 线性映射区 pgd_tmp[0x300]-pgd_tmp[0x37F], 共 512MB，前 8MB 是内核段
+		for(uint32_t i = 0 ; i < VMM_LINEAR_SIZE / VMM_PSE_SIZE ; i++) {
+			pgd_tmp[VMM_PGD_INDEX(KERNEL_BASE) + i] = (i * VMM_PSE_SIZE) | VMM_PAGE_PRESENT | VMM_PAGE_RW | VMM_PAGE_KERNEL | VMM_PAGE_PSE | VMM_PAGE_GLOBAL;
+		}
+	}
+	else {
+		// 内核段 pgd_tmp[0x300], 4MB
+		pgd_tmp[VMM_PGD_INDEX(KERNEL_BASE)] = (ptr_t)pte_kernel_tmp | VMM_PAGE_PRESENT | VMM_PAGE_RW | VMM_PAGE_KERNEL;
+		// 内核段 pgd_tmp[0x301], 4MB
+		pgd_tmp[VMM_PGD_INDEX(KERNEL_BASE) + 1] = (ptr_t)pte_kernel_tmp2 | VMM_PAGE_PRESENT | VMM_PAGE_RW | VMM_PAGE_KERNEL;
+		// 线性映射区的其余部分与恒等映射共用页表
+		for(uint32_t i = KERNEL_SIZE / VMM_PAGE_TABLE_SIZE ; i < VMM_PAGE_TABLES_LINEAR ; i++) {
+			pgd_tmp[VMM_PGD_INDEX(KERNEL_BASE) + i] = pgd_tmp[i];
+		}
+	}
 	pgd_tmp[VMM_PGD_INDEX(KERNEL_STACK_TOP)] = (ptr_t)pte_kernel_stack_tmp | VMM_PAGE_PRESENT | VMM_PAGE_RW | VMM_PAGE_KERNEL;
 	// 映射内核虚拟地址 4MB 到物理地址的前 4MB
 	// 将每个页表项赋值
@@ -66,18 +87,22 @@ void mm_init() {
 	// 映射虚拟地址 0xC0000000-0xC0400000 到物理地址 0x00000000-0x00400000
 	// 不存在冲突问题
 	// pgd_tmp[0x300] => pte_kernel
-	for(uint32_t i = 0 ; i < VMM_PAGES_PRE_PAGE_TABLE  ; i++) {
-		pte_kernel_tmp[i] = (i << 12) | VMM_PAGE_PRESENT | VMM_PAGE_RW | VMM_PAGE_KERNEL;
+	for(uint32_t i = 0 ; i < VMM_PAGES_PRE_PAGE_TABLE && !pse ; i++) {
+		pte_kernel_tmp[i] = (i << 12) | VMM_PAGE_PRESENT | VMM_PAGE_RW | VMM_PAGE_KERNEL | VMM_PAGE_GLOBAL;
 	}
 	// 映射虚拟地址 0xC0400000-0xC0800000 到物理地址 0x00400000-0x00800000
-	for(uint32_t i = 0, j = VMM_PAGES_PRE_PAGE_TABLE ; i < VMM_PAGES_PRE_PAGE_TABLE  ; i++, j++) {
-		pte_kernel_tmp2[i] = (j << 12) | VMM_PAGE_PRESENT | VMM_PAGE_RW | VMM_PAGE_KERNEL;
+	for(uint32_t i = 0, j = VMM_PAGES_PRE_PAGE_TABLE ; i < VMM_PAGES_PRE_PAGE_TABLE && !pse ; i++, j++) {
+		pte_kernel_tmp2[i] = (j << 12) | VMM_PAGE_PRESENT | VMM_PAGE_RW | VMM_PAGE_KERNEL | VMM_PAGE_GLOBAL;
 	}
 	// 映射虚拟地址 0xBFFF8000-0xC0000000 到物理地址 0x00800000-0x00808000
 	for(uint32_t i = VMM_PAGES_PRE_PAGE_TABLE - KERNEL_STACK_PAGES, j = VMM_PAGES_PRE_PAGE_TABLE * 2 ; i < VMM_PAGES_PRE_PAGE_TABLE ; i++, j++) {
-		pte_kernel_stack_tmp[i] = (j << 12) | VMM_PAGE_PRESENT | VMM_PAGE_RW | VMM_PAGE_KERNEL;
+		pte_kernel_stack_tmp[i] = (j << 12) | VMM_PAGE_PRESENT | VMM_PAGE_RW | VMM_PAGE_KERNEL | VMM_PAGE_GLOBAL;
 	}
 	enable_page(pgd_tmp);
+	// 内核映射设为全局页，切换页目录时保留在 TLB 中
+	if(cpu_has_pge() ) {
+		cpu_write_cr4(cpu_read_cr4() | CR4_PGE);
+	}
 
 	return;
 }
@@ -62,8 +62,8 @@ extern "C" {
 
 // WP：对于Intel 80486或以上的CPU，CR0的位16是写保护（Write Proctect）标志。
 // 当设置该标志时，处理器会禁止超级用户程序（例如特权级0的程序）向用户级只读页面执行写操作；当该位复位时则反之。该标志有利于UNIX类操作系统在创建进程时实现写时复制（Copy on Write）技术。
-#define CR0_WP       0x00010020
-#define CR0_AM       0x00040020
+#define CR0_WP       0x00010000
+#define CR0_AM       0x00040000
 #define CR0_NW       0x20000000
 #define CR0_CD       0x40000000
 
@@ -103,12 +103,27 @@ extern "C" {
 #define CR4_OSXSAVE    0x00040000
 #define CR4_SMEP       0x00100000
 
+// CPUID 1 号功能 EDX 中的特性位
+// 支持 4MB 页
+#define CPUID_EDX_PSE   0x00000008
+// 支持全局页
+#define CPUID_EDX_PGE   0x00002000
+// CPUID 1 号功能 ECX 中的特性位
+// 支持 PCID
+#define CPUID_ECX_PCID  0x00020000
+
 // 执行CPU空操作
 static inline void cpu_hlt(void) {
 	__asm__ volatile ("hlt");
 	return;
 }
 
+// 开启中断并等待中断，sti 的下一条指令执行完才响应中断，两者之间的中断不会错过
+static inline void cpu_idle(void) {
+	__asm__ volatile ("sti; hlt" ::: "memory");
+	return;
+}
+
 // 开启中断
 static inline void cpu_sti(void) {
 	__asm__ volatile ("sti" ::: "memory");
@@ -141,6 +156,12 @@ static inline uint32_t cpu_read_cr0(void) {
 	return cr0;
 }
 
+// 写入 CR0
+static inline void cpu_write_cr0(uint32_t cr0) {
+	__asm__ volatile ("mov %0, %%cr0" : : "r" (cr0) : "memory");
+	return;
+}
+
 // 读取 CR2
 static inline uint32_t cpu_read_cr2(void) {
 	uint32_t cr2;
@@ -170,6 +191,39 @@ static inline uint32_t cpu_read_cr4(void) {
 	return cr4;
 }
 
+// 写入 CR4
+static inline void cpu_write_cr4(uint32_t cr4) {
+	__asm__ volatile ("mov %0, %%cr4" : : "r" (cr4) : "memory");
+	return;
+}
+
+// 执行 CPUID
+static inline void cpu_cpuid(uint32_t leaf, uint32_t * eax, uint32_t * ebx, uint32_t * ecx, uint32_t * edx) {
+	__asm__ volatile ("cpuid" : "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx) : "a" (leaf), "c" (0) );
+	return;
+}
+
+// CPU 是否支持 4MB 页
+static inline bool cpu_has_pse(void) {
+	uint32_t eax, ebx, ecx, edx;
+	cpu_cpuid(1, &eax, &ebx, &ecx, &edx);
+	return (edx & CPUID_EDX_PSE) != 0;
+}
+
+// CPU 是否支持全局页
+static inline bool cpu_has_pge(void) {
+	uint32_t eax, ebx, ecx, edx;
+	cpu_cpuid(1, &eax, &ebx, &ecx, &edx);
+	return (edx & CPUID_EDX_PGE) != 0;
+}
+
+// CPU 是否支持 PCID
+static inline bool cpu_has_pcid(void) {
+	uint32_t eax, ebx, ecx, edx;
+	cpu_cpuid(1, &eax, &ebx, &ecx, &edx);
+	return (ecx & CPUID_ECX_PCID) != 0;
+}
+
 // Identification flag
 //程序能够设置或清除这个标志指示了处理器对 CPUID 指令的支持。
 static inline bool FL_ID_status(void) {
@@ -10,18 +10,36 @@ extern "C" {
 #include "stdio.h"
 #include "cpu.hpp"
 #include "sync.hpp"
+#include "mem/pmm.h"
 #include "mem/slab.h"
+#include "mem/vmalloc.h"
 #include "heap/heap.h"
 
 static const heap_manage_t * heap_manager = &slab_manage;
 
+// 内存紧张时归还空闲的页，堆的物理页可能来自任何分区
+static uint32_t heap_shrink(char zone __UNUSED__, uint32_t pages);
+uint32_t heap_shrink(char zone __UNUSED__, uint32_t pages) {
+	uint32_t count = 0;
+	bool intr_flag = false;
+	local_intr_store(intr_flag);
+	{
+		count = heap_manager->heap_manage_shrink(pages);
+	}
+	local_intr_restore(intr_flag);
+	return count;
+}
+
 // 初始化堆
 void heap_init(void) {
 	bool intr_flag = false;
 	local_intr_store(intr_flag);
 	{
 		heap_manager->heap_manage_init(HEAP_START);
+		pmm_shrinker_register(&heap_shrink);
 		printk_info("heap_init\n");
+		// 空闲地址段的节点从堆申请
+		vmalloc_init();
 	}
 	local_intr_restore(intr_flag);
 	return;
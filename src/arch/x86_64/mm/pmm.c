@@ -15,12 +15,84 @@ extern "C" {
 #include "cpu.hpp"
 #include "sync.hpp"
 #include "mem/pmm.h"
+#include "mem/vmm.h"
 #include "mem/firstfit.h"
+#include "mem/buddy.h"
+#include "mem/bitmap.h"
+#include "mem/cma.h"
+#include "mem/memblock.h"
+#include "task/task.h"
 
 // 物理页帧数组长度,可用内存总页数
 static uint32_t phy_pages_count=0;
 
+// 定义 PMM_BUDDY 时使用伙伴系统管理物理内存，定义 PMM_BITMAP 时使用位图
+#ifdef PMM_BUDDY
+static const pmm_manage_t * pmm_manager  = &buddy_manage;
+#elif defined(PMM_BITMAP)
+static const pmm_manage_t * pmm_manager  = &bitmap_manage;
+#else
 static const pmm_manage_t * pmm_manager  = &firstfit_manage;
+#endif
+
+// 定义 PMM_DEFERRED_INIT 时启动阶段只初始化 DMA 分区（内核与物理页数组所在），
+// 其余分区在首次申请时或由 pmm_init_late() 创建的内核线程初始化
+static inline bool pmm_zone_boot(uint32_t zone) {
+#ifdef PMM_DEFERRED_INIT
+	return zone == DMA;
+#else
+	return zone < zone_sum;
+#endif
+}
+
+// 各分区的起止地址
+static const ptr_t pmm_zone_addr[zone_sum + 1] = {
+	DMA_start_addr, NORMAL_start_addr, HIGHMEM_start_addr, PMM_MAX_SIZE
+};
+
+// 可用内存段信息，延迟初始化分区时使用
+static e820map_t pmm_e820map;
+
+// 每 CPU 页缓存
+static pmm_pcp_t pmm_pcp[PMM_CPU_MAX][zone_sum];
+
+// 清零页池，只有 NORMAL 与 HIGHMEM 会被补充
+static pmm_zero_pool_t pmm_zero_pool[zone_sum];
+
+static uint32_t pmm_pcp_shrink(char zone, uint32_t pages);
+static uint32_t pmm_zero_shrink(char zone, uint32_t pages);
+
+// 回收函数，每 CPU 缓存与清零页池最先回收
+static pmm_shrinker_t pmm_shrinkers[PMM_SHRINKER_MAX] = { &pmm_pcp_shrink, &pmm_zero_shrink };
+static uint32_t pmm_shrinker_count = 2;
+
+// 每 CPU 统计信息
+static pmm_stat_t pmm_stat[PMM_CPU_MAX][zone_sum];
+
+static inline void pmm_stat_add(char zone, uint32_t item, uint32_t n) {
+	pmm_stat[pmm_cpu_id()][(uint8_t)zone].count[item] += n;
+	return;
+}
+
+// 分区初始化时管理算法的拆分与合并不计入
+static inline void pmm_stat_reset(uint32_t zone) {
+	for(uint32_t cpu = 0 ; cpu < PMM_CPU_MAX ; cpu++) {
+		bzero(&pmm_stat[cpu][zone], sizeof(pmm_stat_t) );
+	}
+	return;
+}
+
+// 物理页数组，启动时从 memblock 申请
+physical_page * mem_page = NULL;
+uint32_t mem_page_count = 0;
+
+// 设置 [addr, addr + pages 页) 的引用计数
+static inline void pmm_page_ref_set(ptr_t addr, uint32_t pages, uint32_t ref) {
+	for(uint32_t i = 0 ; i < pages ; i++) {
+		page_set_ref(addr_page(addr + i * PMM_PAGE_SIZE), ref);
+	}
+	return;
+}
 
 // 从 GRUB 读取物理内存信息
 static void pmm_get_ram_info(e820map_t * e820map);
@@ -30,98 +102,158 @@ void pmm_get_ram_info(e820map_t * e820map) {
 	    + ( (struct multiboot_tag_mmap *)mmap_tag)->entry_size) ) {
 		// 如果是可用内存
 		//printk("addr:%x%x,len:%x%x,type:%x:\n",mmap_entries->addr,mmap_entries->len,mmap_entries->type);
-		if((unsigned)mmap_entries->type == MULTIBOOT_MEMORY_AVAILABLE)//&& (unsigned)(mmap_entries->addr & 0xFFFFFFFF) == 0x100000
+		if((unsigned)mmap_entries->type == MULTIBOOT_MEMORY_AVAILABLE && e820map->nr_map < E820_MAX)//&& (unsigned)(mmap_entries->addr & 0xFFFFFFFF) == 0x100000
 		{   
 			e820map->map[e820map->nr_map].addr = mmap_entries->addr;
 			e820map->map[e820map->nr_map].length = mmap_entries->len;
 			e820map->map[e820map->nr_map].type = mmap_entries->type;
 			e820map->nr_map++;
+			// 物理页数组只需要覆盖到最高的可用内存
+			// 超过 PMM_MAX_SIZE 的部分没有被映射，不管理
+			uint64_t end = mmap_entries->addr + mmap_entries->len;
+			if(end > PMM_MAX_SIZE) {
+				end = PMM_MAX_SIZE;
+			}
+			if(end / PMM_PAGE_SIZE > mem_page_count) {
+				mem_page_count = end / PMM_PAGE_SIZE;
+			}
 		}
 	}
 	return;
 }
 
-void pmm_phy_init(e820map_t * e820map) {
-	//分区页面总数
-	uint32_t count_dma=0,count_normal=0,count_highmem=0;
-	//分区空闲页面总数
-	uint32_t free_dma=0,free_normal=0,free_highmem=0;
-	/****************************/
-	//初始化mem_map数组
-	for(uint32_t i=0;i<PMM_PAGE_MAX_SIZE;i++)
-	{
-		ptr_t address=i*PMM_PAGE_SIZE;
-		mem_page[i].start=address;
-		mem_page[i].ref=-1;
-		if(address<(ptr_t)NORMAL_start_addr) //小于16MB
-			count_dma++;
-		else if(address<(ptr_t)HIGHMEM_start_addr) //大于16MB小于110MB
-			count_normal++;
-		else
-			count_highmem++;
-	}
-	/****************************/
-	// 计算可用内存段的物理页总数	
-	for(uint32_t i = 0 ; i < e820map->nr_map ; i++) {
-		//printk_info("addr:0x%X\n",&kernel_init_start);
-		//printk_info("addr:0x%X\n",(ptr_t)&kernel_data_end);
-		for(ptr_t addr = e820map->map[i].addr ;
-		    addr < e820map->map[i].addr + e820map->map[i].length ;
-		    addr += PMM_PAGE_SIZE) {
-			/*******************************************************/
-			//初始化可用内存段的物理页数组
-			//ptr_t address=(ptr_t)addr;
-			//地址对应的物理页数组下标
-			uint32_t j=(addr&PMM_PAGE_MASK)/PMM_PAGE_SIZE;
-			//mem_page[j].start=address;
-			if(addr>=(ptr_t)&kernel_init_start && addr<=((ptr_t)&kernel_end-(ptr_t)0xc0000000))
-				//内核已占用
-				mem_page[j].ref=1;
-			else if(addr<(ptr_t)NORMAL_start_addr) //小于16MB
-			{
-				mem_page[j].zone=0;
-				mem_page[j].ref=0;
-				free_dma++;
+// 该地址是否已被内核或启动阶段申请的内存占用
+static inline bool pmm_page_used(ptr_t addr) {
+	return memblock_is_reserved(addr);
+}
+
+// 初始化一个分区的物理页数组，并设置分区的总页面和空闲页面信息
+static void pmm_phy_zone_init(uint32_t zone);
+void pmm_phy_zone_init(uint32_t zone) {
+	uint32_t pfn_start = pmm_zone_addr[zone] / PMM_PAGE_SIZE;
+	uint32_t pfn_end = pmm_zone_addr[zone + 1] / PMM_PAGE_SIZE;
+	uint32_t free = 0;
+	if(pfn_end > mem_page_count) {
+		pfn_end = mem_page_count;
+	}
+	if(pfn_start > pfn_end) {
+		pfn_start = pfn_end;
+	}
+	for(uint32_t i = pfn_start ; i < pfn_end ; i++) {
+		mem_page[i].flags = PMM_PG_RESERVED;
+		page_set_zone(&mem_page[i], zone);
+	}
+	// 只处理可用内存段落在本分区内的部分
+	for(uint32_t i = 0 ; i < pmm_e820map.nr_map ; i++) {
+		uint64_t start = pmm_e820map.map[i].addr / PMM_PAGE_SIZE;
+		uint64_t end = (pmm_e820map.map[i].addr + pmm_e820map.map[i].length + PMM_PAGE_SIZE - 1) / PMM_PAGE_SIZE;
+		if(start < pfn_start) {
+			start = pfn_start;
+		}
+		if(end > pfn_end) {
+			end = pfn_end;
+		}
+		for(uint32_t j = start ; j < end ; j++) {
+			page_clear_flag(&mem_page[j], PMM_PG_RESERVED);
+			if(pmm_page_used(j * PMM_PAGE_SIZE) ) {
+				page_set_ref(&mem_page[j], 1);
 			}
-			else if(addr<(ptr_t)HIGHMEM_start_addr) //大于16MB小于110MB
-			{
-				mem_page[j].zone=1;
-				mem_page[j].ref=0;
-				free_normal++;
+			else {
+				page_set_ref(&mem_page[j], 0);
+				free++;
 			}
-			else
-			{
-				mem_page[j].zone=2;
-				mem_page[j].ref=0;
-				free_highmem++;
-			}	
-
 			phy_pages_count++;
 		}
 	}
-	//设置分区的总页面和空闲页面信息
-	mem_zone[DMA].all_pages=count_dma;
-	printk_info("%d\n",mem_zone[DMA].all_pages);
-	mem_zone[DMA].free_pages=free_dma;
-	mem_zone[NORMAL].all_pages=count_normal;
-	mem_zone[NORMAL].free_pages=free_normal;
-	mem_zone[HIGHMEM].all_pages=count_highmem;
-	mem_zone[HIGHMEM].free_pages=free_highmem;
-	//分别设置分区的极值点和平衡条件
-	for(int i=0;i<zone_sum;i++)
+	mem_zone[zone].all_pages = pfn_end - pfn_start;
+	mem_zone[zone].free_pages = free;
+	//设置分区的极值点和平衡条件，空闲页低于 pages_low 时开始回收，回收到 pages_high
+	mem_zone[zone].pages_min = mem_zone[zone].all_pages / 32;
+	mem_zone[zone].pages_low = mem_zone[zone].all_pages / 16;
+	mem_zone[zone].pages_high = mem_zone[zone].all_pages * 3 / 32;
+	mem_zone[zone].need_balance = false;
+	return;
+}
+
+// 初始化一个还没有初始化的分区，首次申请或后台线程调用
+static void pmm_zone_init(uint32_t zone);
+void pmm_zone_init(uint32_t zone) {
+	bool intr_flag = false;
+	local_intr_store(intr_flag);
 	{
-		mem_zone[i].pages_min=mem_zone[i].all_pages/3;
-		mem_zone[i].pages_low=mem_zone[i].all_pages/2;
-		mem_zone[i].pages_high=mem_zone[i].all_pages*2/3;
-		mem_zone[i].need_balance=false;
+		if(!mem_zone[zone].inited) {
+			pmm_phy_zone_init(zone);
+			pmm_manager->pmm_manage_zone_init(zone);
+			pmm_stat_reset(zone);
+			mem_zone[zone].inited = true;
+		}
+	}
+	local_intr_restore(intr_flag);
+	return;
+}
+
+void pmm_phy_init(e820map_t * e820map) {
+	//后面的分区初始化时还要用到
+	memcpy(&pmm_e820map, e820map, sizeof(e820map_t) );
+	//在此之后、管理算法初始化完成之前的内存都从 memblock 申请
+	memblock_init(e820map);
+	//物理页数组按实际内存大小分配，通过线性映射区访问
+	mem_page = (physical_page *)memblock_alloc(mem_page_count * sizeof(physical_page), sizeof(physical_page) );
+	assert(mem_page != NULL, "Error at pmm.c: no memory for mem_page\n");
+	//只初始化启动时需要的分区，其余的留给 pmm_zone_init()
+	for(uint32_t i = 0 ; i < zone_sum ; i++) {
+		mem_zone[i].inited = false;
+		if(pmm_zone_boot(i) ) {
+			pmm_phy_zone_init(i);
+		}
 	}
-	/*******************************************************/
+	printk_info("%d\n",mem_zone[DMA].all_pages);
 	return;
 }
 
 void pmm_mamage_init() {
-	// 因为只有一个可用内存区域，所以直接传递
 	pmm_manager->pmm_manage_init();
+	for(uint32_t i = 0 ; i < zone_sum ; i++) {
+		if(pmm_zone_boot(i) ) {
+			pmm_manager->pmm_manage_zone_init(i);
+			pmm_stat_reset(i);
+			mem_zone[i].inited = true;
+		}
+	}
+	// DMA 分区总是在启动时初始化
+	cma_init();
+	return;
+}
+
+#ifdef PMM_DEFERRED_INIT
+// 后台初始化剩余的分区，每次只关一个分区的中断
+static int32_t pmm_init_thread(void * args __UNUSED__) {
+	for(uint32_t i = 0 ; i < zone_sum ; i++) {
+		pmm_zone_init(i);
+	}
+	printk_info("pmm_init_late: phy_pages_count: %d\n", phy_pages_count);
+	return 0;
+}
+#endif
+
+// 平衡线程，每次时钟中断后检查一遍各分区
+static int32_t pmm_balance_thread(void * args __UNUSED__) {
+	while(1) {
+		for(uint32_t i = 0 ; i < zone_sum ; i++) {
+			if(mem_zone[i].inited && mem_zone[i].need_balance) {
+				pmm_balance(i);
+			}
+		}
+		cpu_hlt();
+	}
+	return 0;
+}
+
+void pmm_init_late(void) {
+#ifdef PMM_DEFERRED_INIT
+	kernel_thread(pmm_init_thread, NULL, 0);
+#endif
+	kernel_thread(pmm_balance_thread, NULL, 0);
 	return;
 }
 
@@ -139,8 +271,8 @@ void pmm_init() {
 	printk_info("phy_pages_count: %d\n", phy_pages_count);
 	printk_info("phy_pages_allow_count: %d\n", pmm_free_pages_count(DMA) );
 	/********************************/
-	/*printk_info("mem_page[0] addr:0x%08X\n",mem_page[0].start);
-	printk_info("mem_page[0] ref:%d\n",mem_page[0].ref);
+	/*printk_info("mem_page[0] addr:0x%08X\n",page_addr(&mem_page[0]));
+	printk_info("mem_page[0] ref:%d\n",page_ref(&mem_page[0]));
 	printk_info("mem_dma free_pages:%d\n",mem_zone[DMA].free_pages);
 	printk_info("mem_dma pages_min:%d\n",mem_zone[DMA].pages_min);
 	printk_info("mem_dma pages_low:%d\n",mem_zone[DMA].pages_low);
@@ -167,19 +299,623 @@ void pmm_init() {
 	return;
 }
 
-ptr_t pmm_alloc(uint32_t byte,char zone) {
+// 从管理算法批量补充冷页，调用者需关中断
+static void pmm_pcp_refill(pmm_pcp_t * pcp, char zone) {
+	while(pcp->cold_count < PMM_PCP_BATCH) {
+		ptr_t page = pmm_manager->pmm_manage_alloc(PMM_PAGE_SIZE, zone);
+		if(page == (ptr_t)NULL) {
+			break;
+		}
+		pcp->cold[pcp->cold_count++] = page;
+	}
+	return;
+}
+
+// 将最旧的 count 个热页归还给管理算法，调用者需关中断
+static void pmm_pcp_free_hot(pmm_pcp_t * pcp, uint32_t count, char zone) {
+	while(count-- > 0 && pcp->hot_count > 0) {
+		pmm_manager->pmm_manage_free(pcp->hot[pcp->hot_head], PMM_PAGE_SIZE, zone);
+		pcp->hot_head = (pcp->hot_head + 1) % PMM_PCP_HIGH;
+		pcp->hot_count--;
+	}
+	return;
+}
+
+// 单页申请，先热页，再冷页，都没有时批量补充
+static ptr_t pmm_pcp_alloc(char zone) {
+	ptr_t page = (ptr_t)NULL;
+	bool intr_flag = false;
+	local_intr_store(intr_flag);
+	{
+		pmm_pcp_t * pcp = &pmm_pcp[pmm_cpu_id()][(uint8_t)zone];
+		if(pcp->hot_count > 0) {
+			pcp->hot_count--;
+			page = pcp->hot[(pcp->hot_head + pcp->hot_count) % PMM_PCP_HIGH];
+		}
+		else {
+			if(pcp->cold_count == 0) {
+				pmm_pcp_refill(pcp, zone);
+			}
+			if(pcp->cold_count > 0) {
+				page = pcp->cold[--pcp->cold_count];
+			}
+		}
+	}
+	local_intr_restore(intr_flag);
+	return page;
+}
+
+// 单页释放，放入热页，满了就批量归还最旧的
+static void pmm_pcp_free(ptr_t addr, char zone) {
+	bool intr_flag = false;
+	local_intr_store(intr_flag);
+	{
+		pmm_pcp_t * pcp = &pmm_pcp[pmm_cpu_id()][(uint8_t)zone];
+		if(pcp->hot_count == PMM_PCP_HIGH) {
+			pmm_pcp_free_hot(pcp, PMM_PCP_BATCH, zone);
+		}
+		pcp->hot[(pcp->hot_head + pcp->hot_count) % PMM_PCP_HIGH] = addr;
+		pcp->hot_count++;
+	}
+	local_intr_restore(intr_flag);
+	return;
+}
+
+void pmm_pcp_drain(char zone) {
+	bool intr_flag = false;
+	local_intr_store(intr_flag);
+	{
+		pmm_pcp_t * pcp = &pmm_pcp[pmm_cpu_id()][(uint8_t)zone];
+		pmm_pcp_free_hot(pcp, pcp->hot_count, zone);
+		while(pcp->cold_count > 0) {
+			pmm_manager->pmm_manage_free(pcp->cold[--pcp->cold_count], PMM_PAGE_SIZE, zone);
+		}
+	}
+	local_intr_restore(intr_flag);
+	return;
+}
+
+// 缓存的页只能满足单页申请，所以按管理算法中的空闲页判断
+static uint32_t pmm_pcp_shrink(char zone, uint32_t pages __UNUSED__) {
+	uint32_t count = pmm_manager->pmm_manage_free_pages_count(zone);
+	pmm_pcp_drain(zone);
+	return pmm_manager->pmm_manage_free_pages_count(zone) - count;
+}
+
+// 清零页池中的页直接还给管理算法
+static uint32_t pmm_zero_shrink(char zone, uint32_t pages) {
+	uint32_t count = 0;
+	bool intr_flag = false;
+	local_intr_store(intr_flag);
+	{
+		pmm_zero_pool_t * pool = &pmm_zero_pool[(uint8_t)zone];
+		while(count < pages && pool->count > 0) {
+			pmm_manager->pmm_manage_free(pool->page[--pool->count], PMM_PAGE_SIZE, zone);
+			count++;
+		}
+	}
+	local_intr_restore(intr_flag);
+	return count;
+}
+
+// 从 zone 分区的清零页池取一页，池空时返回 NULL
+static ptr_t pmm_zero_get(char zone);
+ptr_t pmm_zero_get(char zone) {
+	ptr_t page = (ptr_t)NULL;
+	bool intr_flag = false;
+	local_intr_store(intr_flag);
+	{
+		pmm_zero_pool_t * pool = &pmm_zero_pool[(uint8_t)zone];
+		if(pool->count > 0) {
+			page = pool->page[--pool->count];
+		}
+	}
+	local_intr_restore(intr_flag);
+	return page;
+}
+
+bool pmm_idle(void) {
+#ifdef PMM_DEFERRED_INIT
+	for(uint32_t i = 0 ; i < zone_sum ; i++) {
+		if(!mem_zone[i].inited) {
+			pmm_zone_init(i);
+			return true;
+		}
+	}
+#endif
+	for(uint32_t i = 0 ; i < zone_sum ; i++) {
+		if(mem_zone[i].inited && mem_zone[i].need_balance) {
+			pmm_balance(i);
+			return true;
+		}
+	}
+	const char zonelist[] = { NORMAL, HIGHMEM };
+	for(uint32_t i = 0 ; i < sizeof(zonelist) ; i++) {
+		char zone = zonelist[i];
+		pmm_zero_pool_t * pool = &pmm_zero_pool[(uint8_t)zone];
+		// 不主动初始化分区，内存紧张时也不补充
+		if(!mem_zone[(uint8_t)zone].inited || pool->count >= PMM_ZERO_POOL_MAX
+		    || pmm_manager->pmm_manage_free_pages_count(zone) < mem_zone[(uint8_t)zone].pages_high) {
+			continue;
+		}
+		ptr_t page = (ptr_t)NULL;
+		bool intr_flag = false;
+		local_intr_store(intr_flag);
+		{
+			page = pmm_manager->pmm_manage_alloc(PMM_PAGE_SIZE, zone);
+		}
+		local_intr_restore(intr_flag);
+		if(page == (ptr_t)NULL) {
+			continue;
+		}
+		// 清零时不关中断，物理页通过线性映射区访问
+		bzero( (void *)VMM_PA_LA(page), PMM_PAGE_SIZE);
+		local_intr_store(intr_flag);
+		{
+			if(pool->count < PMM_ZERO_POOL_MAX) {
+				pool->page[pool->count++] = page;
+			}
+			else {
+				pmm_manager->pmm_manage_free(page, PMM_PAGE_SIZE, zone);
+			}
+		}
+		local_intr_restore(intr_flag);
+		return true;
+	}
+	return false;
+}
+
+bool pmm_shrinker_register(pmm_shrinker_t shrinker) {
+	bool res = false;
+	bool intr_flag = false;
+	local_intr_store(intr_flag);
+	{
+		if(pmm_shrinker_count < PMM_SHRINKER_MAX) {
+			pmm_shrinkers[pmm_shrinker_count++] = shrinker;
+			res = true;
+		}
+	}
+	local_intr_restore(intr_flag);
+	return res;
+}
+
+void pmm_balance(char zone) {
+	bool intr_flag = false;
+	local_intr_store(intr_flag);
+	{
+		memory_zone * mz = &mem_zone[(uint8_t)zone];
+		uint32_t free = pmm_manager->pmm_manage_free_pages_count(zone);
+		for(uint32_t i = 0 ; i < pmm_shrinker_count && free < mz->pages_high ; i++) {
+			pmm_shrinkers[i](zone, mz->pages_high - free);
+			free = pmm_manager->pmm_manage_free_pages_count(zone);
+		}
+		// 后注册的回收函数逐页释放的页进入了每 CPU 缓存，不计入空闲页，最后再归还一次
+		if(free < mz->pages_high) {
+			pmm_pcp_drain(zone);
+		}
+		// 回收不到也清除，下次申请时再检查
+		mz->need_balance = false;
+	}
+	local_intr_restore(intr_flag);
+	return;
+}
+
+// 空闲页不足时唤醒平衡线程
+static inline void pmm_zone_check(char zone) {
+	if(pmm_manager->pmm_manage_free_pages_count(zone) < mem_zone[(uint8_t)zone].pages_low) {
+		mem_zone[(uint8_t)zone].need_balance = true;
+	}
+	return;
+}
+
+// 多页申请直接交给管理算法，与每 CPU 缓存的补充、归还一样关中断
+static ptr_t pmm_manage_alloc_pages(uint32_t byte, char zone);
+ptr_t pmm_manage_alloc_pages(uint32_t byte, char zone) {
+	ptr_t page = (ptr_t)NULL;
+	bool intr_flag = false;
+	local_intr_store(intr_flag);
+	{
+		page = pmm_manager->pmm_manage_alloc(byte, zone);
+	}
+	local_intr_restore(intr_flag);
+	return page;
+}
+
+// 从 zone 分区申请，reclaim 为 true 时失败后同步回收再重试一次
+static ptr_t pmm_zone_alloc(uint32_t byte, char zone, bool reclaim);
+ptr_t pmm_zone_alloc(uint32_t byte, char zone, bool reclaim) {
 	ptr_t page;
-	page = pmm_manager->pmm_manage_alloc(byte,zone);
+	if(!mem_zone[(uint8_t)zone].inited) {
+		pmm_zone_init(zone);
+	}
+	if(byte > 0 && byte <= PMM_PAGE_SIZE) {
+		page = pmm_pcp_alloc(zone);
+	}
+	else {
+		page = pmm_manage_alloc_pages(byte, zone);
+	}
+	if(page == (ptr_t)NULL && byte > 0 && reclaim) {
+		pmm_balance(zone);
+		page = (byte <= PMM_PAGE_SIZE) ? pmm_pcp_alloc(zone) : pmm_manage_alloc_pages(byte, zone);
+	}
+	if(page != (ptr_t)NULL) {
+		pmm_page_ref_set(page, (byte + PMM_PAGE_SIZE - 1) / PMM_PAGE_SIZE, 1);
+		pmm_stat_add(zone, PMM_STAT_ALLOC, (byte + PMM_PAGE_SIZE - 1) / PMM_PAGE_SIZE);
+	}
+	else {
+		pmm_stat_add(zone, PMM_STAT_FAIL, (byte + PMM_PAGE_SIZE - 1) / PMM_PAGE_SIZE);
+	}
+	pmm_zone_check(zone);
 	return page;
 }
 
+ptr_t pmm_alloc(uint32_t byte,char zone) {
+	if(zone < 0 || zone >= zone_sum) {
+		printk_err("Error at pmm.c: ptr_t pmm_alloc(uint32_t, char)\n");
+		return (ptr_t)NULL;
+	}
+	return pmm_zone_alloc(byte, zone, true);
+}
+
+// zone 分区是否可以满足 pages 页的申请，作为后备分区时 DMA 需要保留一部分
+static bool pmm_zone_allow(char zone, uint32_t pages, bool fallback);
+bool pmm_zone_allow(char zone, uint32_t pages, bool fallback) {
+	if(!mem_zone[(uint8_t)zone].inited) {
+		pmm_zone_init(zone);
+	}
+	uint32_t free = pmm_free_pages_count(zone);
+	if(free < pages) {
+		return false;
+	}
+	if(fallback && zone == DMA
+	    && free - pages < mem_zone[DMA].all_pages / PMM_DMA_RESERVE_RATIO) {
+		return false;
+	}
+	return true;
+}
+
+ptr_t pmm_alloc_flags(uint32_t byte, uint32_t flags) {
+	// 后备顺序
+	const char zonelist[zone_sum] = { NORMAL, HIGHMEM, DMA };
+	uint32_t pages = (byte + PMM_PAGE_SIZE - 1) / PMM_PAGE_SIZE;
+	// 单页的清零申请先查清零页池
+	if( (flags & PMM_ZERO) && pages == 1) {
+		for(uint32_t i = 0 ; i < zone_sum ; i++) {
+			if(flags & PMM_ZONE_FLAG(zonelist[i]) ) {
+				ptr_t page = pmm_zero_get(zonelist[i]);
+				if(page != (ptr_t)NULL) {
+					page_set_ref(addr_page(page), 1);
+					pmm_stat_add(zonelist[i], PMM_STAT_ALLOC, 1);
+					return page;
+				}
+			}
+		}
+	}
+	// 第一遍只取现成的空闲页，都不满足时第二遍再回收
+	for(uint32_t pass = 0 ; pass < 2 ; pass++) {
+		if(pass == 1 && (flags & PMM_NORETRY) ) {
+			break;
+		}
+		bool fallback = false;
+		for(uint32_t i = 0 ; i < zone_sum ; i++) {
+			char zone = zonelist[i];
+			if( (flags & PMM_ZONE_FLAG(zone) ) == 0) {
+				continue;
+			}
+			// 回收后重试时不再动用 DMA 的保留部分
+			bool allow = (pass == 0) ? pmm_zone_allow(zone, pages, fallback) : !(fallback && zone == DMA);
+			if(allow) {
+				ptr_t page = pmm_zone_alloc(byte, zone, pass == 1);
+				if(page != (ptr_t)NULL) {
+					if(flags & PMM_ZERO) {
+						bzero( (void *)VMM_PA_LA(page), pages * PMM_PAGE_SIZE);
+					}
+					return page;
+				}
+			}
+			fallback = true;
+		}
+	}
+	// 不回收的申请由调用者处理失败，其余的输出各分区状态便于定位
+	if( (flags & PMM_NORETRY) == 0) {
+		printk_err("Error at pmm.c: ptr_t pmm_alloc_flags(uint32_t, uint32_t)\n");
+		pmm_stat_print();
+	}
+	return (ptr_t)NULL;
+}
+
+// 大页不经过每 CPU 缓存，分区顺序与回收方式同 pmm_alloc_flags()
+ptr_t pmm_alloc_large(uint32_t flags) {
+	const char zonelist[zone_sum] = { NORMAL, HIGHMEM, DMA };
+	for(uint32_t pass = 0 ; pass < 2 ; pass++) {
+		if(pass == 1 && (flags & PMM_NORETRY) ) {
+			break;
+		}
+		bool fallback = false;
+		for(uint32_t i = 0 ; i < zone_sum ; i++) {
+			char zone = zonelist[i];
+			if( (flags & PMM_ZONE_FLAG(zone) ) == 0) {
+				continue;
+			}
+			bool allow = (pass == 0) ? pmm_zone_allow(zone, PMM_LARGE_PAGE_PAGES, fallback) : !(fallback && zone == DMA);
+			fallback = true;
+			if(!allow) {
+				continue;
+			}
+			if(pass == 1) {
+				pmm_balance(zone);
+			}
+			ptr_t page = (ptr_t)NULL;
+			bool intr_flag = false;
+			local_intr_store(intr_flag);
+			{
+				page = pmm_manager->pmm_manage_alloc_align(PMM_LARGE_PAGE_SIZE, PMM_LARGE_PAGE_SIZE, zone);
+				if(page != (ptr_t)NULL) {
+					pmm_page_ref_set(page, PMM_LARGE_PAGE_PAGES, 1);
+					page_set_flag(addr_page(page), PMM_PG_LARGE);
+				}
+			}
+			local_intr_restore(intr_flag);
+			pmm_stat_add(zone, (page != (ptr_t)NULL) ? PMM_STAT_ALLOC : PMM_STAT_FAIL, PMM_LARGE_PAGE_PAGES);
+			pmm_zone_check(zone);
+			if(page != (ptr_t)NULL) {
+				if(flags & PMM_ZERO) {
+					bzero( (void *)VMM_PA_LA(page), PMM_LARGE_PAGE_SIZE);
+				}
+				return page;
+			}
+		}
+	}
+	if( (flags & PMM_NORETRY) == 0) {
+		printk_err("Error at pmm.c: ptr_t pmm_alloc_large(uint32_t)\n");
+		pmm_stat_print();
+	}
+	return (ptr_t)NULL;
+}
+
+void pmm_free_large(ptr_t addr) {
+	if( (addr & (PMM_LARGE_PAGE_SIZE - 1) ) != 0 || addr / PMM_PAGE_SIZE >= mem_page_count
+	    || !page_flag(addr_page(addr), PMM_PG_LARGE) ) {
+		printk_err("Error at pmm.c: void pmm_free_large(ptr_t)\n");
+		return;
+	}
+	page_clear_flag(addr_page(addr), PMM_PG_LARGE);
+	pmm_free_page(addr, PMM_LARGE_PAGE_SIZE, page_zone(addr_page(addr) ) );
+	return;
+}
+
+// 一次关中断完成，先取缓存中的页，再交给管理算法
+uint32_t pmm_alloc_bulk(char zone, uint32_t n, ptr_t * frames) {
+	uint32_t count = 0;
+	if(zone < 0 || zone >= zone_sum) {
+		printk_err("Error at pmm.c: uint32_t pmm_alloc_bulk(char, uint32_t, ptr_t *)\n");
+		return 0;
+	}
+	if(!mem_zone[(uint8_t)zone].inited) {
+		pmm_zone_init(zone);
+	}
+	bool intr_flag = false;
+	local_intr_store(intr_flag);
+	{
+		pmm_pcp_t * pcp = &pmm_pcp[pmm_cpu_id()][(uint8_t)zone];
+		while(count < n && pcp->hot_count > 0) {
+			pcp->hot_count--;
+			frames[count++] = pcp->hot[(pcp->hot_head + pcp->hot_count) % PMM_PCP_HIGH];
+		}
+		while(count < n && pcp->cold_count > 0) {
+			frames[count++] = pcp->cold[--pcp->cold_count];
+		}
+		// 管理算法支持时一次取完
+		if(count < n && pmm_manager->pmm_manage_alloc_bulk != NULL) {
+			count += pmm_manager->pmm_manage_alloc_bulk(zone, n - count, frames + count);
+		}
+		while(count < n) {
+			ptr_t page = pmm_manager->pmm_manage_alloc(PMM_PAGE_SIZE, zone);
+			if(page == (ptr_t)NULL) {
+				break;
+			}
+			frames[count++] = page;
+		}
+		for(uint32_t i = 0 ; i < count ; i++) {
+			page_set_ref(addr_page(frames[i]), 1);
+		}
+		pmm_stat_add(zone, PMM_STAT_ALLOC, count);
+		if(count < n) {
+			pmm_stat_add(zone, PMM_STAT_FAIL, n - count);
+		}
+	}
+	local_intr_restore(intr_flag);
+	pmm_zone_check(zone);
+	return count;
+}
+
+// 放入各自分区的热页缓存，满了就批量归还最旧的
+void pmm_free_bulk(uint32_t n, ptr_t * frames) {
+	bool intr_flag = false;
+	local_intr_store(intr_flag);
+	{
+		for(uint32_t i = 0 ; i < n ; i++) {
+			if(frames[i] / PMM_PAGE_SIZE >= mem_page_count) {
+				printk_err("Error at pmm.c: void pmm_free_bulk(uint32_t, ptr_t *)\n");
+				continue;
+			}
+			// 借用的连续内存区域页直接归还
+			if(cma_contains(frames[i]) ) {
+				cma_release(frames[i]);
+				continue;
+			}
+			char zone = page_zone(addr_page(frames[i]) );
+			page_set_ref(addr_page(frames[i]), 0);
+			pmm_stat_add(zone, PMM_STAT_FREE, 1);
+			pmm_pcp_t * pcp = &pmm_pcp[pmm_cpu_id()][(uint8_t)zone];
+			if(pcp->hot_count == PMM_PCP_HIGH) {
+				pmm_pcp_free_hot(pcp, PMM_PCP_BATCH, zone);
+			}
+			pcp->hot[(pcp->hot_head + pcp->hot_count) % PMM_PCP_HIGH] = frames[i];
+			pcp->hot_count++;
+		}
+	}
+	local_intr_restore(intr_flag);
+	return;
+}
+
 void pmm_free_page(ptr_t addr, uint32_t byte,char zone) {
-	pmm_manager->pmm_manage_free(addr,byte,zone);
+	if(zone < 0 || zone >= zone_sum) {
+		printk_err("Error at pmm.c: void pmm_free_page(ptr_t, uint32_t, char)\n");
+		return;
+	}
+	if(cma_contains(addr) ) {
+		cma_release(addr);
+		return;
+	}
+	pmm_page_ref_set(addr, (byte + PMM_PAGE_SIZE - 1) / PMM_PAGE_SIZE, 0);
+	pmm_stat_add(zone, PMM_STAT_FREE, (byte + PMM_PAGE_SIZE - 1) / PMM_PAGE_SIZE);
+	if(byte > 0 && byte <= PMM_PAGE_SIZE) {
+		pmm_pcp_free(addr, zone);
+		return;
+	}
+	bool intr_flag = false;
+	local_intr_store(intr_flag);
+	{
+		pmm_manager->pmm_manage_free(addr,byte,zone);
+	}
+	local_intr_restore(intr_flag);
+	return;
+}
+
+void pmm_free(ptr_t addr, uint32_t byte) {
+	if(addr / PMM_PAGE_SIZE >= mem_page_count) {
+		printk_err("Error at pmm.c: void pmm_free(ptr_t, uint32_t)\n");
+		return;
+	}
+	pmm_free_page(addr, byte, page_zone(addr_page(addr) ) );
+	return;
+}
+
+void page_get(physical_page * page) {
+	bool intr_flag = false;
+	local_intr_store(intr_flag);
+	{
+		assert(page_ref(page) > 0 && page_ref(page) < PMM_PG_REF_MAX, "Error at pmm.c: void page_get(physical_page *)\n");
+		page_set_ref(page, page_ref(page) + 1);
+	}
+	local_intr_restore(intr_flag);
+	return;
+}
+
+// 减为 0 时按单页或大页释放
+void page_put(physical_page * page) {
+	bool last = false;
+	bool intr_flag = false;
+	local_intr_store(intr_flag);
+	{
+		if(page_ref(page) == 0) {
+			printk_err("Error at pmm.c: void page_put(physical_page *)\n");
+		}
+		else {
+			page_set_ref(page, page_ref(page) - 1);
+			last = (page_ref(page) == 0);
+		}
+	}
+	local_intr_restore(intr_flag);
+	if(!last) {
+		return;
+	}
+	if(page_flag(page, PMM_PG_LARGE) ) {
+		pmm_free_large(page_addr(page) );
+	}
+	else {
+		pmm_free_page(page_addr(page), PMM_PAGE_SIZE, page_zone(page) );
+	}
 	return;
 }
 
+// 缓存与清零页池中的页也是空闲的，未初始化的分区还不能分配，返回 0
 uint32_t pmm_free_pages_count(char zone) {
-	return pmm_manager->pmm_manage_free_pages_count(zone);
+	if(zone < 0 || zone >= zone_sum || !mem_zone[(uint8_t)zone].inited) {
+		return 0;
+	}
+	uint32_t count = pmm_manager->pmm_manage_free_pages_count(zone);
+	for(uint32_t cpu = 0 ; cpu < PMM_CPU_MAX ; cpu++) {
+		count += pmm_pcp[cpu][(uint8_t)zone].hot_count + pmm_pcp[cpu][(uint8_t)zone].cold_count;
+	}
+	count += pmm_zero_pool[(uint8_t)zone].count;
+	return count;
+}
+
+void pmm_stat_inc(char zone, uint32_t item) {
+	pmm_stat_add(zone, item, 1);
+	return;
+}
+
+void pmm_stat_get(char zone, pmm_stat_t * stat) {
+	bzero(stat, sizeof(pmm_stat_t) );
+	if(zone < 0 || zone >= zone_sum) {
+		return;
+	}
+	for(uint32_t cpu = 0 ; cpu < PMM_CPU_MAX ; cpu++) {
+		for(uint32_t i = 0 ; i < PMM_STAT_MAX ; i++) {
+			stat->count[i] += pmm_stat[cpu][(uint8_t)zone].count[i];
+		}
+	}
+	return;
+}
+
+// 缓存与清零页池中的页按单页块计入
+void pmm_frag_get(char zone, pmm_frag_t * frag) {
+	bzero(frag, sizeof(pmm_frag_t) );
+	if(zone < 0 || zone >= zone_sum || !mem_zone[(uint8_t)zone].inited) {
+		return;
+	}
+	bool intr_flag = false;
+	local_intr_store(intr_flag);
+	{
+		pmm_manager->pmm_manage_frag(zone, frag);
+	}
+	local_intr_restore(intr_flag);
+	uint32_t cached = pmm_free_pages_count(zone) - pmm_manager->pmm_manage_free_pages_count(zone);
+	frag->blocks[0] += cached;
+	frag->pages[0] += cached;
+	return;
+}
+
+// 不能满足申请的空闲页，即位于小于 2^order 页的块中的页，所占的百分比
+uint32_t pmm_frag_index(char zone, uint32_t order) {
+	pmm_frag_t frag;
+	pmm_frag_get(zone, &frag);
+	uint32_t free = 0;
+	uint32_t unusable = 0;
+	for(uint32_t i = 0 ; i < PMM_FRAG_ORDER ; i++) {
+		free += frag.pages[i];
+		if(i < order) {
+			unusable += frag.pages[i];
+		}
+	}
+	return (free == 0) ? 0 : unusable * 100 / free;
+}
+
+void pmm_stat_print(void) {
+	const char * zone_name[zone_sum] = { "DMA", "NORMAL", "HIGHMEM" };
+	printk_info("pmm: %s\n", pmm_manager->name);
+	for(uint32_t z = 0 ; z < zone_sum ; z++) {
+		if(!mem_zone[z].inited) {
+			printk_info("%s: not inited\n", zone_name[z]);
+			continue;
+		}
+		pmm_stat_t stat;
+		pmm_frag_t frag;
+		pmm_stat_get(z, &stat);
+		pmm_frag_get(z, &frag);
+		printk_info("%s: free %d/%d, alloc %d, free %d, fail %d, split %d, merge %d\n", zone_name[z],
+		    pmm_free_pages_count(z), mem_zone[z].all_pages, stat.count[PMM_STAT_ALLOC], stat.count[PMM_STAT_FREE],
+		    stat.count[PMM_STAT_FAIL], stat.count[PMM_STAT_SPLIT], stat.count[PMM_STAT_MERGE]);
+		printk_info("%s: blocks", zone_name[z]);
+		for(uint32_t i = 0 ; i < PMM_FRAG_ORDER ; i++) {
+			printk(" %d", frag.blocks[i]);
+		}
+		printk(", frag index(4MB) %d%%\n", pmm_frag_index(z, PMM_FRAG_ORDER - 1) );
+	}
+	return;
 }
 
 #ifdef __cplusplus
@@ -14,13 +14,43 @@ extern "C" {
 #include "sync.hpp"
 #include "intr/include/intr.h"
 #include "mem/vmm.h"
+#include "task/task.h"
 
 // 内核页目录区域
 pgd_t pgd_kernel[VMM_PAGE_TABLES_PRE_PAGE_DIRECTORY] __attribute__( (aligned(VMM_PAGE_SIZE) ) );
-// 内核页表区域
-pte_t pte_kernel[VMM_PAGE_TABLES_KERNEL][VMM_PAGES_PRE_PAGE_TABLE] __attribute__( (aligned(VMM_PAGE_SIZE) ) );
+// 线性映射区页表，没有 PSE 时使用
+pte_t pte_kernel[VMM_PAGE_TABLES_LINEAR][VMM_PAGES_PRE_PAGE_TABLE] __attribute__( (aligned(VMM_PAGE_SIZE) ) );
 // 内核栈区域
 pte_t pte_kernel_stack[VMM_PAGES_PRE_PAGE_TABLE] __attribute__( (aligned(VMM_PAGE_SIZE) ) );
+// 每 CPU 页表页缓存
+static vmm_quicklist_t vmm_quicklist[PMM_CPU_MAX];
+
+// 内存紧张时归还缓存中 zone 分区的页
+static uint32_t vmm_quicklist_shrink(char zone, uint32_t pages);
+
+#ifdef VMM_PCID
+// 每个 PCID 当前属于的页目录物理地址
+static ptr_t vmm_pcid_owner[VMM_PCID_MAX];
+// 最近一次使用的时间，池满时替换最久未使用的
+static uint32_t vmm_pcid_stamp[VMM_PCID_MAX];
+static uint32_t vmm_pcid_clock = 0;
+
+// 返回切换到 pd 时 CR3 的低位，PCID 中的缓存仍属于 pd 时带有 VMM_CR3_NOFLUSH
+static ptr_t vmm_pcid_get(ptr_t pd);
+// 收回 pd 的 PCID，pd 不是当前页目录而被修改或释放时使用
+static void vmm_pcid_put(ptr_t pd);
+#endif
+
+// 取得 va 所在的页表，不存在时 alloc 为 true 则申请一页新的页表，返回内核线性地址
+static pte_t * vmm_get_pte(pgd_t * pgd_now, ptr_t va, bool alloc);
+// 刷新 [va, va + pages * VMM_PAGE_SIZE) 的页表缓存，页数多时整体刷新
+static void vmm_flush_range(pgd_t * pgd_now, ptr_t va, size_t pages, bool global);
+// pa 是否由物理内存管理并计数，外设映射与启动时的映射不是
+static inline bool vmm_page_counted(ptr_t pa);
+// 写时复制，addr 所在页带有 VMM_PAGE_COW 时复制或直接改为可写，成功返回 true
+static bool vmm_do_cow_fault(ptr_t addr, uint32_t err_code);
+// 按需分配页，addr 位于当前任务的匿名内存区域中时映射一页清零的物理页，成功返回 true
+static bool vmm_do_anon_fault(ptr_t addr, uint32_t err_code);
 
 void vmm_init(void) {
 	bool intr_flag = false;
@@ -28,14 +58,22 @@ void vmm_init(void) {
 	{
 		register_interrupt_handler(INT_PAGE_FAULT, &page_fault);
 
-		// 映射全部内核
+		// 映射线性区，包括全部内核，bootinit 已经开启 PSE 时使用 4MB 页，不需要页表
+		// 之后没有恒等映射，页目录、页表与其它物理页都通过线性区访问
 		uint32_t pgd_idx = VMM_PGD_INDEX(KERNEL_BASE);
-		for(uint32_t i = pgd_idx, j = 0 ; i < VMM_PAGE_DIRECTORIES_KERNEL + pgd_idx ; i++, j++) {
-			pgd_kernel[i] = ( (ptr_t)VMM_LA_PA( (ptr_t)pte_kernel[j]) | VMM_PAGE_PRESENT | VMM_PAGE_RW | VMM_PAGE_KERNEL);
+		if(CR4_PSE_status() ) {
+			for(uint32_t i = 0 ; i < VMM_LINEAR_SIZE / VMM_PSE_SIZE ; i++) {
+				pgd_kernel[pgd_idx + i] = (i * VMM_PSE_SIZE) | VMM_PAGE_PRESENT | VMM_PAGE_RW | VMM_PAGE_KERNEL | VMM_PAGE_PSE | VMM_PAGE_GLOBAL;
+			}
 		}
-		ptr_t * pte = (ptr_t *)pte_kernel;
-		for(uint32_t i = 0 ; i < VMM_PAGES_PRE_PAGE_TABLE * VMM_PAGE_TABLES_KERNEL ; i++) {
-			pte[i] = (i << 12) | VMM_PAGE_PRESENT | VMM_PAGE_RW | VMM_PAGE_KERNEL;
+		else {
+			for(uint32_t i = pgd_idx, j = 0 ; j < VMM_PAGE_TABLES_LINEAR ; i++, j++) {
+				pgd_kernel[i] = ( (ptr_t)VMM_LA_PA( (ptr_t)pte_kernel[j]) | VMM_PAGE_PRESENT | VMM_PAGE_RW | VMM_PAGE_KERNEL);
+			}
+			ptr_t * pte = (ptr_t *)pte_kernel;
+			for(uint32_t i = 0 ; i < VMM_PAGES_PRE_PAGE_TABLE * VMM_PAGE_TABLES_LINEAR ; i++) {
+				pte[i] = (i << 12) | VMM_PAGE_PRESENT | VMM_PAGE_RW | VMM_PAGE_KERNEL | VMM_PAGE_GLOBAL;
+			}
 		}
 		// 映射内核栈
 		// 0x2FF
@@ -43,49 +81,252 @@ void vmm_init(void) {
 		pgd_kernel[pgd_idx] = ( (ptr_t)VMM_LA_PA( (ptr_t)pte_kernel_stack) | VMM_PAGE_PRESENT | VMM_PAGE_RW | VMM_PAGE_KERNEL);
 		// i: 0x3F8~0x400
 		for(uint32_t i = VMM_PAGES_PRE_PAGE_TABLE - KERNEL_STACK_PAGES, j = VMM_PAGES_PRE_PAGE_TABLE * 2 ; i < VMM_PAGES_PRE_PAGE_TABLE ; i++, j++) {
-			pte_kernel_stack[i] = (j << 12) | VMM_PAGE_PRESENT | VMM_PAGE_RW | VMM_PAGE_KERNEL;
+			pte_kernel_stack[i] = (j << 12) | VMM_PAGE_PRESENT | VMM_PAGE_RW | VMM_PAGE_KERNEL | VMM_PAGE_GLOBAL;
 		}
+#ifdef VMM_PCID
+		// 开启时 CR3 的低 12 位必须为 0，在切换到带 PCID 的页目录之前开启
+		if(cpu_has_pcid() ) {
+			cpu_write_cr4(cpu_read_cr4() | CR4_PCIDE);
+		}
+#endif
 		switch_pgd(VMM_LA_PA( (ptr_t)pgd_kernel) );
+		// 内核态写只读页时同样触发缺页，写时复制才对内核线程有效
+		cpu_write_cr0(cpu_read_cr0() | CR0_WP);
+		pmm_shrinker_register(&vmm_quicklist_shrink);
 		printk_info("vmm_init\n");
 	}
 	local_intr_restore(intr_flag);
 	return;
 }
 
-// 以页为单位
-void map(pgd_t * pgd_now, ptr_t va, ptr_t pa, uint32_t flags) {
+ptr_t vmm_pt_alloc(void) {
+	ptr_t pa = (ptr_t)NULL;
+	bool intr_flag = false;
+	local_intr_store(intr_flag);
+	{
+		vmm_quicklist_t * ql = &vmm_quicklist[pmm_cpu_id()];
+		if(ql->count > 0) {
+			pa = ql->page[--ql->count];
+		}
+	}
+	local_intr_restore(intr_flag);
+	if(pa == (ptr_t)NULL) {
+		pa = pmm_alloc_flags(VMM_PAGE_SIZE, VMM_PT_ZONES | PMM_ZERO);
+	}
+	// 线性映射区之外的页无法访问
+	if(pa != (ptr_t)NULL && pa >= VMM_LINEAR_SIZE) {
+		printk_err("Error at vmm.c: ptr_t vmm_pt_alloc(void)\n");
+		pmm_free(pa, VMM_PAGE_SIZE);
+		return (ptr_t)NULL;
+	}
+	return pa;
+}
+
+void vmm_pt_free(ptr_t pa) {
+	bool cached = false;
+	bool intr_flag = false;
+	local_intr_store(intr_flag);
+	{
+		vmm_quicklist_t * ql = &vmm_quicklist[pmm_cpu_id()];
+		if(ql->count < VMM_QUICKLIST_MAX) {
+			ql->page[ql->count++] = pa;
+			cached = true;
+		}
+	}
+	local_intr_restore(intr_flag);
+	if(!cached) {
+		pmm_free(pa, VMM_PAGE_SIZE);
+	}
+	return;
+}
+
+// 缓存中的页仍然处于已申请状态，归还后才计入空闲页
+uint32_t vmm_quicklist_shrink(char zone, uint32_t pages) {
+	uint32_t count = 0;
+	// 缓存中只有从 VMM_PT_ZONES 申请的页
+	if( (VMM_PT_ZONES & PMM_ZONE_FLAG(zone) ) == 0) {
+		return 0;
+	}
+	for(uint32_t cpu = 0 ; cpu < PMM_CPU_MAX ; cpu++) {
+		vmm_quicklist_t * ql = &vmm_quicklist[cpu];
+		for(uint32_t i = 0 ; i < ql->count && count < pages ; ) {
+			if(page_zone(addr_page(ql->page[i]) ) != (uint8_t)zone) {
+				i++;
+				continue;
+			}
+			pmm_free(ql->page[i], VMM_PAGE_SIZE);
+			ql->page[i] = ql->page[--ql->count];
+			count++;
+		}
+	}
+	return count;
+}
+
+pte_t * vmm_get_pte(pgd_t * pgd_now, ptr_t va, bool alloc) {
 	uint32_t pgd_idx = VMM_PGD_INDEX(va);
-	uint32_t pte_idx = VMM_PTE_INDEX(va);
-	pte_t * pte = (pte_t *)(pgd_now[pgd_idx] & VMM_PAGE_MASK);
+	// 4MB 页中不能再映射单独的页
+	if(pgd_now[pgd_idx] & VMM_PAGE_PSE) {
+		return NULL;
+	}
+	ptr_t pte = pgd_now[pgd_idx] & VMM_PAGE_MASK;
+	if(pte == (ptr_t)NULL) {
+		if(alloc == false) {
+			return NULL;
+		}
+		pte = vmm_pt_alloc();
+		if(pte == (ptr_t)NULL) {
+			return NULL;
+		}
+		// 页目录项的权限是页表中所有页的上限，之后同一页表中还会有别的映射，
+		// 所以页目录项不做限制，由页表项决定权限，内核地址不允许用户访问
+		pgd_now[pgd_idx] = pte | VMM_PAGE_PRESENT | VMM_PAGE_RW | ( (va < KERNEL_BASE) ? VMM_PAGE_USER : VMM_PAGE_KERNEL);
+	}
 	// 转换到内核线性地址
-	if(pte == NULL) {
-		pgd_now[pgd_idx] = (uint32_t)pte | flags;
-		pte = (pte_t *)VMM_PA_LA( (ptr_t)pte);
-	} else {
-		pte = (pte_t *)VMM_PA_LA( (ptr_t)pte);
+	return (pte_t *)VMM_PA_LA(pte);
+}
+
+#ifdef VMM_PCID
+// 新分配或者替换来的 PCID 中可能有别的页目录的缓存，第一次加载时刷新
+ptr_t vmm_pcid_get(ptr_t pd) {
+	uint32_t victim = 1;
+	vmm_pcid_clock++;
+	for(uint32_t i = 1 ; i < VMM_PCID_MAX ; i++) {
+		if(vmm_pcid_owner[i] == pd) {
+			vmm_pcid_stamp[i] = vmm_pcid_clock;
+			return i | VMM_CR3_NOFLUSH;
+		}
+		if(vmm_pcid_stamp[i] < vmm_pcid_stamp[victim]) {
+			victim = i;
+		}
 	}
+	vmm_pcid_owner[victim] = pd;
+	vmm_pcid_stamp[victim] = vmm_pcid_clock;
+	return victim;
+}
 
-	pte[pte_idx] = (pa & VMM_PAGE_MASK) | flags;
-	// 通知 CPU 更新页表缓存
-	CPU_INVLPG(va);
+void vmm_pcid_put(ptr_t pd) {
+	for(uint32_t i = 1 ; i < VMM_PCID_MAX ; i++) {
+		if(vmm_pcid_owner[i] == pd) {
+			vmm_pcid_owner[i] = (ptr_t)NULL;
+			vmm_pcid_stamp[i] = 0;
+		}
+	}
+	return;
+}
+#endif
+
+// invlpg 对全局页同样有效，整体刷新时需要区分
+void vmm_flush_range(pgd_t * pgd_now __UNUSED__, ptr_t va, size_t pages, bool global) {
+#ifdef VMM_PCID
+	// 其它页目录的缓存可能还留在它的 PCID 中
+	if(VMM_LA_PA( (ptr_t)pgd_now) != (cpu_read_cr3() & VMM_PAGE_MASK) ) {
+		vmm_pcid_put(VMM_LA_PA( (ptr_t)pgd_now) );
+	}
+#endif
+	if(pages > VMM_INVLPG_MAX) {
+		if(global == true) {
+			flush_tlb_all();
+		}
+		else {
+			__asm__ volatile ("mov %0, %%cr3" : : "r" (cpu_read_cr3() ) : "memory");
+		}
+		return;
+	}
+	for(size_t i = 0 ; i < pages ; i++) {
+		CPU_INVLPG(va + i * VMM_PAGE_SIZE);
+	}
+	return;
+}
+
+// 以页为单位
+void map(pgd_t * pgd_now, ptr_t va, ptr_t pa, uint32_t flags) {
+	if(map_range(pgd_now, va, pa, 1, flags) != 1) {
+		printk_err("Error at vmm.c: void map(pgd_t *, ptr_t, ptr_t, uint32_t)\n");
+	}
 	return;
 }
 
 void unmap(pgd_t * pgd_now, ptr_t va) {
-	uint32_t pgd_idx = VMM_PGD_INDEX(va);
-	uint32_t pte_idx = VMM_PTE_INDEX(va);
-	pte_t * pte = (pte_t *)(pgd_now[pgd_idx] & VMM_PAGE_MASK);
-	// 转换到内核线性地址
-	pte = (pte_t *)VMM_PA_LA( (ptr_t)pte);
-	pte[pte_idx] = 0;
+	unmap_range(pgd_now, va, 1);
+	return;
+}
+
+// 每个页表只查找一次，全部写完后统一刷新页表缓存
+size_t map_range(pgd_t * pgd_now, ptr_t va, ptr_t pa, size_t pages, uint32_t flags) {
+	va &= VMM_PAGE_MASK;
+	pa &= VMM_PAGE_MASK;
+	size_t count = 0;
+	while(count < pages) {
+		ptr_t addr = va + count * VMM_PAGE_SIZE;
+		pte_t * pte = vmm_get_pte(pgd_now, addr, true);
+		if(pte == NULL) {
+			printk_err("Error at vmm.c: size_t map_range(pgd_t *, ptr_t, ptr_t, size_t, uint32_t)\n");
+			break;
+		}
+		// 写到这个页表的末尾或者写完为止
+		for(uint32_t pte_idx = VMM_PTE_INDEX(addr) ; pte_idx < VMM_PAGES_PRE_PAGE_TABLE && count < pages ; pte_idx++, count++) {
+			pte[pte_idx] = (pa + count * VMM_PAGE_SIZE) | flags;
+		}
+	}
+	// 通知 CPU 更新页表缓存
+	vmm_flush_range(pgd_now, va, count, (flags & VMM_PAGE_GLOBAL) != 0);
+	return count;
+}
+
+void unmap_range(pgd_t * pgd_now, ptr_t va, size_t pages) {
+	va &= VMM_PAGE_MASK;
+	size_t count = 0;
+	bool global = false;
+	while(count < pages) {
+		ptr_t addr = va + count * VMM_PAGE_SIZE;
+		uint32_t pte_idx = VMM_PTE_INDEX(addr);
+		size_t n = VMM_PAGES_PRE_PAGE_TABLE - pte_idx;
+		if(n > pages - count) {
+			n = pages - count;
+		}
+		if(pgd_now[VMM_PGD_INDEX(addr)] & VMM_PAGE_PSE) {
+			printk_err("Error at vmm.c: void unmap_range(pgd_t *, ptr_t, size_t)\n");
+		}
+		else {
+			// 没有页表说明整段都没有映射，直接跳过
+			pte_t * pte = vmm_get_pte(pgd_now, addr, false);
+			for(size_t i = 0 ; pte != NULL && i < n ; i++) {
+				global |= (pte[pte_idx + i] & VMM_PAGE_GLOBAL) != 0;
+				pte[pte_idx + i] = 0;
+			}
+		}
+		count += n;
+	}
 	// 通知 CPU 更新页表缓存
-	CPU_INVLPG(va);
+	vmm_flush_range(pgd_now, va, count, global);
 	return;
 }
 
+// 已经存在的页表不重复申请，失败时已经申请的页表保留
+bool vmm_prealloc_pte(pgd_t * pgd_now, ptr_t start, ptr_t end) {
+	for(ptr_t va = start & VMM_PSE_MASK ; va < end ; va += VMM_PAGE_TABLE_SIZE) {
+		if(vmm_get_pte(pgd_now, va, true) == NULL) {
+			printk_err("Error at vmm.c: bool vmm_prealloc_pte(pgd_t *, ptr_t, ptr_t)\n");
+			return false;
+		}
+		// 最后一个页表之后地址回绕
+		if(va + VMM_PAGE_TABLE_SIZE < va) {
+			break;
+		}
+	}
+	return true;
+}
+
 uint32_t get_mapping(pgd_t * pgd_now, ptr_t va, ptr_t * pa) {
 	uint32_t pgd_idx = VMM_PGD_INDEX(va);
 	uint32_t pte_idx = VMM_PTE_INDEX(va);
+	// 4MB 页直接由页目录项得出
+	if( (pgd_now[pgd_idx] & (VMM_PAGE_PRESENT | VMM_PAGE_PSE) ) == (VMM_PAGE_PRESENT | VMM_PAGE_PSE) ) {
+		if( (void *)pa != NULL) {
+			*pa = (pgd_now[pgd_idx] & VMM_PSE_MASK) + (va & ~VMM_PSE_MASK & VMM_PAGE_MASK);
+		}
+		return 1;
+	}
 
 	pte_t * pte = (pte_t *)(pgd_now[pgd_idx] & VMM_PAGE_MASK);
 	if(pte == NULL) {
@@ -107,11 +348,204 @@ void switch_pgd(ptr_t pd) {
 	bool intr_flag = false;
 	local_intr_store(intr_flag);
 	{
+#ifdef VMM_PCID
+		if(CR4_PCIDE_status() ) {
+			pd |= vmm_pcid_get(pd);
+		}
+#endif
 		__asm__ volatile ("mov %0, %%cr3" : : "r" (pd) );
 	}
 	local_intr_restore(intr_flag);
 }
 
+// 重新加载 CR3 不会清除全局页，需要关闭再打开 CR4.PGE
+void flush_tlb_all(void) {
+	bool intr_flag = false;
+	local_intr_store(intr_flag);
+	{
+		uint32_t cr4 = cpu_read_cr4();
+		if(cr4 & CR4_PGE) {
+			cpu_write_cr4(cr4 & ~CR4_PGE);
+			cpu_write_cr4(cr4);
+		}
+		else {
+			__asm__ volatile ("mov %0, %%cr3" : : "r" (cpu_read_cr3() ) : "memory");
+		}
+	}
+	local_intr_restore(intr_flag);
+	return;
+}
+
+bool vmm_page_counted(ptr_t pa) {
+	return pa / PMM_PAGE_SIZE < mem_page_count && page_ref(addr_page(pa) ) > 0;
+}
+
+// 内核部分与 pgd_kernel 中的项相同，PSE 项只用于内核，也直接共享
+pgd_t * vmm_copy_pgd(pgd_t * pgd_src) {
+	ptr_t pgd_pa = vmm_pt_alloc();
+	if(pgd_pa == (ptr_t)NULL) {
+		printk_err("Error at vmm.c: pgd_t * vmm_copy_pgd(pgd_t *)\n");
+		return NULL;
+	}
+	pgd_t * pgd_dst = (pgd_t *)VMM_PA_LA(pgd_pa);
+	bool shared = false;
+	bool failed = false;
+	bool intr_flag = false;
+	local_intr_store(intr_flag);
+	{
+		for(uint32_t i = 0 ; i < VMM_PAGE_TABLES_PRE_PAGE_DIRECTORY ; i++) {
+			if(pgd_src[i] == 0) {
+				continue;
+			}
+			if(pgd_src[i] == pgd_kernel[i] || (pgd_src[i] & VMM_PAGE_PSE) ) {
+				pgd_dst[i] = pgd_src[i];
+				continue;
+			}
+			ptr_t pte_pa = vmm_pt_alloc();
+			if(pte_pa == (ptr_t)NULL) {
+				failed = true;
+				break;
+			}
+			pte_t * pte_src = (pte_t *)VMM_PA_LA( (pgd_src[i] & VMM_PAGE_MASK) );
+			pte_t * pte_dst = (pte_t *)VMM_PA_LA(pte_pa);
+			for(uint32_t j = 0 ; j < VMM_PAGES_PRE_PAGE_TABLE ; j++) {
+				if( (pte_src[j] & VMM_PAGE_PRESENT) == 0) {
+					continue;
+				}
+				// 没有引用计数的页直接共享，不做写时复制
+				if(!vmm_page_counted(pte_src[j] & VMM_PAGE_MASK) ) {
+					pte_dst[j] = pte_src[j];
+					continue;
+				}
+				// 可写的页改为只读，两边都标记写时复制
+				if(pte_src[j] & VMM_PAGE_RW) {
+					pte_src[j] = (pte_src[j] & ~VMM_PAGE_RW) | VMM_PAGE_COW;
+					shared = true;
+				}
+				page_get(addr_page(pte_src[j] & VMM_PAGE_MASK) );
+				pte_dst[j] = pte_src[j];
+			}
+			pgd_dst[i] = pte_pa | (pgd_src[i] & ~VMM_PAGE_MASK);
+		}
+		// 原页目录中的可写映射已经改为只读，正在使用时需要刷新
+		if(shared && VMM_LA_PA( (ptr_t)pgd_src) == (cpu_read_cr3() & VMM_PAGE_MASK) ) {
+			__asm__ volatile ("mov %0, %%cr3" : : "r" (cpu_read_cr3() ) : "memory");
+		}
+#ifdef VMM_PCID
+		else if(shared) {
+			vmm_pcid_put(VMM_LA_PA( (ptr_t)pgd_src) );
+		}
+#endif
+	}
+	local_intr_restore(intr_flag);
+	// 中途失败时已经复制的部分一起释放，原页目录中的页保持只读，写入时会直接改回可写
+	if(failed) {
+		printk_err("Error at vmm.c: pgd_t * vmm_copy_pgd(pgd_t *)\n");
+		vmm_free_pgd(pgd_dst);
+		return NULL;
+	}
+	return pgd_dst;
+}
+
+// 逐项清除，页目录与页表放回缓存时已经是清零的
+void vmm_free_pgd(pgd_t * pgd_now) {
+	if(pgd_now == NULL || pgd_now == pgd_kernel) {
+		return;
+	}
+	for(uint32_t i = 0 ; i < VMM_PAGE_TABLES_PRE_PAGE_DIRECTORY ; i++) {
+		if(pgd_now[i] == 0) {
+			continue;
+		}
+		if(pgd_now[i] != pgd_kernel[i] && (pgd_now[i] & VMM_PAGE_PSE) == 0) {
+			pte_t * pte = (pte_t *)VMM_PA_LA( (pgd_now[i] & VMM_PAGE_MASK) );
+			for(uint32_t j = 0 ; j < VMM_PAGES_PRE_PAGE_TABLE ; j++) {
+				if( (pte[j] & VMM_PAGE_PRESENT) && vmm_page_counted(pte[j] & VMM_PAGE_MASK) ) {
+					page_put(addr_page(pte[j] & VMM_PAGE_MASK) );
+				}
+				pte[j] = 0;
+			}
+			vmm_pt_free(pgd_now[i] & VMM_PAGE_MASK);
+		}
+		pgd_now[i] = 0;
+	}
+#ifdef VMM_PCID
+	vmm_pcid_put(VMM_LA_PA( (ptr_t)pgd_now) );
+#endif
+	vmm_pt_free(VMM_LA_PA( (ptr_t)pgd_now) );
+	return;
+}
+
+// 只有最后一个使用者时不需要复制
+bool vmm_do_cow_fault(ptr_t addr, uint32_t err_code) {
+	if( (err_code & (VMM_PF_PRESENT | VMM_PF_WRITE) ) != (VMM_PF_PRESENT | VMM_PF_WRITE) ) {
+		return false;
+	}
+	if(curr_task == NULL || curr_task->mm == NULL || curr_task->mm->pgd_dir == NULL) {
+		return false;
+	}
+	pte_t * pte = vmm_get_pte(curr_task->mm->pgd_dir, addr, false);
+	if(pte == NULL) {
+		return false;
+	}
+	pte += VMM_PTE_INDEX(addr);
+	if( (*pte & (VMM_PAGE_PRESENT | VMM_PAGE_COW) ) != (VMM_PAGE_PRESENT | VMM_PAGE_COW) ) {
+		return false;
+	}
+	ptr_t old_pa = *pte & VMM_PAGE_MASK;
+	uint32_t flags = (*pte & ~VMM_PAGE_MASK & ~VMM_PAGE_COW) | VMM_PAGE_RW;
+	// 没有引用计数的页不会被共享，直接改回可写
+	if(!vmm_page_counted(old_pa) || page_ref(addr_page(old_pa) ) == 1) {
+		*pte = old_pa | flags;
+	}
+	else {
+		ptr_t new_pa = pmm_alloc_flags(VMM_PAGE_SIZE, PMM_KERNEL);
+		if(new_pa == (ptr_t)NULL) {
+			return false;
+		}
+		// 任务页目录中没有恒等映射，通过线性映射区复制
+		memcpy( (void *)VMM_PA_LA(new_pa), (void *)VMM_PA_LA(old_pa), VMM_PAGE_SIZE);
+		*pte = new_pa | flags;
+		page_put(addr_page(old_pa) );
+	}
+	CPU_INVLPG(addr);
+	return true;
+}
+
+// 这些区域在创建任务时只保留地址，第一次访问时才分配物理页
+bool vmm_do_anon_fault(ptr_t addr, uint32_t err_code) {
+	// 只处理页不存在的情况，权限错误说明访问本身不合法
+	if( (err_code & VMM_PF_PRESENT) || curr_task == NULL || curr_task->mm == NULL) {
+		return false;
+	}
+	task_mem_t * mm = curr_task->mm;
+	if(mm->pgd_dir == NULL) {
+		return false;
+	}
+	vma_t * vma = vma_find(&mm->vma, addr);
+	if(vma == NULL || (vma->flags & VMA_ANON) == 0) {
+		return false;
+	}
+	if( (err_code & VMM_PF_WRITE) && (vma->flags & VMA_WRITE) == 0) {
+		return false;
+	}
+	uint32_t flags = VMM_PAGE_PRESENT;
+	if(vma->flags & VMA_WRITE) {
+		flags |= VMM_PAGE_RW;
+	}
+	if(vma->flags & VMA_USER) {
+		flags |= VMM_PAGE_USER;
+	}
+	ptr_t pa = pmm_alloc_flags(VMM_PAGE_SIZE, PMM_KERNEL | PMM_ZERO);
+	if(pa == (ptr_t)NULL) {
+		return false;
+	}
+	if(map_range(mm->pgd_dir, addr & VMM_PAGE_MASK, pa, 1, flags) != 1) {
+		pmm_free(pa, VMM_PAGE_SIZE);
+		return false;
+	}
+	return true;
+}
+
 void page_fault(pt_regs_t * pt_regs) {
 #ifdef __x86_64__
 	uint64_t cr2;
@@ -120,27 +554,30 @@ void page_fault(pt_regs_t * pt_regs) {
 	uint32_t cr2;
 	__asm__ volatile ("mov %%cr2,%0" : "=r" (cr2) );
 #endif
+	if(vmm_do_cow_fault( (ptr_t)cr2, pt_regs->err_code) || vmm_do_anon_fault( (ptr_t)cr2, pt_regs->err_code) ) {
+		return;
+	}
 	printk("Page fault at 0x%08X, virtual faulting address 0x%08X\n", pt_regs->eip, cr2);
 	printk_err("Error code: 0x%08X\n", pt_regs->err_code);
 
 	// bit 0 为 0 指页面不存在内存里
-	if(!(pt_regs->err_code & 0x1) )
+	if(!(pt_regs->err_code & VMM_PF_PRESENT) )
 		printk_color(red, "Because the page wasn't present.\n");
 	// bit 1 为 0 表示读错误，为 1 为写错误
-	if(pt_regs->err_code & 0x2)
+	if(pt_regs->err_code & VMM_PF_WRITE)
 		printk_err("Write error.\n");
 	else
 		printk_err("Read error.\n");
 	// bit 2 为 1 表示在用户模式打断的，为 0 是在内核模式打断的
-	if(pt_regs->err_code & 0x4)
+	if(pt_regs->err_code & VMM_PF_USER)
 		printk_err("In user mode.\n");
 	else
 		printk_err("In kernel mode.\n");
 	// bit 3 为 1 表示错误是由保留位覆盖造成的
-	if(pt_regs->err_code & 0x8)
+	if(pt_regs->err_code & VMM_PF_RESERVED)
 		printk_err("Reserved bits being overwritten.\n");
 	// bit 4 为 1 表示错误发生在取指令的时候
-	if(pt_regs->err_code & 0x10)
+	if(pt_regs->err_code & VMM_PF_FETCH)
 		printk_err("The fault occurred during an instruction fetch.\n");
 	while(1);
 }
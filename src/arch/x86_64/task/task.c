@@ -136,11 +136,36 @@ static void copy_thread(task_pcb_t * task, pt_regs_t * pt_regs) {
 	return;
 }
 
+// 设置新任务的地址空间，栈是任务自己的，不复制
+static void copy_mm(task_pcb_t * task, uint32_t flags) {
+	if(curr_task == NULL || curr_task->mm == NULL || curr_task->mm->pgd_dir == NULL) {
+		return;
+	}
+	task_mem_t * mm = curr_task->mm;
+	if( (flags & TASK_FORK_COW) == 0) {
+		task->mm->pgd_dir = mm->pgd_dir;
+		return;
+	}
+	task->mm->pgd_dir = vmm_copy_pgd(mm->pgd_dir);
+	assert(task->mm->pgd_dir != NULL, "Error at task.c: copy_mm. No enough memory!\n");
+	assert(vma_set_copy(&task->mm->vma, &mm->vma), "Error at task.c: copy_mm. No enough memory!\n");
+	task->mm->task_start = mm->task_start;
+	task->mm->code_start = mm->code_start;
+	task->mm->code_end = mm->code_end;
+	task->mm->data_start = mm->data_start;
+	task->mm->data_end = mm->data_end;
+	task->mm->heap_start = mm->heap_start;
+	task->mm->heap_end = mm->heap_end;
+	task->mm->task_end = mm->task_end;
+	return;
+}
+
 // 创建 PCB，设置相关信息后加入调度链表
-pid_t do_fork(uint32_t flags __UNUSED__, pt_regs_t * pt_regs) {
+pid_t do_fork(uint32_t flags, pt_regs_t * pt_regs) {
 	assert(curr_task_count < TASK_MAX, "Error: task.c curr_task_count >= TASK_MAX");
 	task_pcb_t * task = alloc_task_pcb();
 	assert(task != NULL, "Error: task.c task==NULL");
+	copy_mm(task, flags);
 	copy_thread(task, pt_regs);
 	task->status = TASK_RUNNABLE;
 	list_append(&runnable_list, task);
@@ -252,7 +277,10 @@ void show_task_mem(pid_t pid) {
 		printk("mm->code_end: 0x%08X\t", task_mm->code_end);
 		printk("mm->data_start: 0x%08X\t", task_mm->data_start);
 		printk("mm->data_end: 0x%08X\t", task_mm->data_end);
-		printk("mm->task_end: 0x%08X\n", task_mm->task_end);
+		printk("mm->heap_start: 0x%08X\t", task_mm->heap_start);
+		printk("mm->heap_end: 0x%08X\t", task_mm->heap_end);
+		printk("mm->task_end: 0x%08X\t", task_mm->task_end);
+		printk("mm->vma.count: %d\n", task_mm->vma.count);
 		return;
 	}
 	else {
@@ -0,0 +1,216 @@
+
+// This file is a part of MRNIU/SimpleKernel (https://github.com/MRNIU/SimpleKernel).
+//
+// avltree.c for MRNIU/SimpleKernel.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stddef.h"
+#include "include/avltree.h"
+
+static inline int32_t avl_height(avl_node_t * node) {
+	return (node == NULL) ? 0 : node->height;
+}
+
+/* Children must be up to date, their data is used by the callback */
+static inline void avl_update(avl_root_t * root, avl_node_t * node) {
+	int32_t hl = avl_height(node->left);
+	int32_t hr = avl_height(node->right);
+	node->height = ( (hl > hr) ? hl : hr) + 1;
+	if(root->update != NULL)
+		root->update(node);
+	return;
+}
+
+/* Point the link of parent (or the root) that refers to old at new */
+static inline void avl_replace_child(avl_root_t * root, avl_node_t * parent,
+    avl_node_t * old, avl_node_t * new) {
+	if(parent == NULL)
+		root->node = new;
+	else if(parent->left == old)
+		parent->left = new;
+	else
+		parent->right = new;
+	if(new != NULL)
+		new->parent = parent;
+	return;
+}
+
+static avl_node_t * avl_rotate_left(avl_root_t * root, avl_node_t * node) {
+	avl_node_t * pivot = node->right;
+	node->right = pivot->left;
+	if(pivot->left != NULL)
+		pivot->left->parent = node;
+	avl_replace_child(root, node->parent, node, pivot);
+	pivot->left = node;
+	node->parent = pivot;
+	avl_update(root, node);
+	avl_update(root, pivot);
+	return pivot;
+}
+
+static avl_node_t * avl_rotate_right(avl_root_t * root, avl_node_t * node) {
+	avl_node_t * pivot = node->left;
+	node->left = pivot->right;
+	if(pivot->right != NULL)
+		pivot->right->parent = node;
+	avl_replace_child(root, node->parent, node, pivot);
+	pivot->right = node;
+	node->parent = pivot;
+	avl_update(root, node);
+	avl_update(root, pivot);
+	return pivot;
+}
+
+/* Restore the AVL property at node, returns the new subtree root */
+static avl_node_t * avl_balance(avl_root_t * root, avl_node_t * node) {
+	avl_update(root, node);
+	int32_t diff = avl_height(node->left) - avl_height(node->right);
+	if(diff > 1) {
+		if(avl_height(node->left->left) < avl_height(node->left->right) )
+			avl_rotate_left(root, node->left);
+		return avl_rotate_right(root, node);
+	}
+	if(diff < -1) {
+		if(avl_height(node->right->right) < avl_height(node->right->left) )
+			avl_rotate_right(root, node->right);
+		return avl_rotate_left(root, node);
+	}
+	return node;
+}
+
+/* Walk up to the root, fixing every node on the way */
+static void avl_rebalance(avl_root_t * root, avl_node_t * node) {
+	while(node != NULL) {
+		node = avl_balance(root, node);
+		node = node->parent;
+	}
+	return;
+}
+
+void avl_init_root(avl_root_t * root) {
+	root->node = NULL;
+	root->update = NULL;
+	return;
+}
+
+void avl_init_root_augmented(avl_root_t * root, AVLUpdateFunc update_func) {
+	root->node = NULL;
+	root->update = update_func;
+	return;
+}
+
+/* The order is unchanged, so only the data needs fixing, not the balance */
+void avl_propagate(avl_root_t * root, avl_node_t * node) {
+	if(root->update == NULL)
+		return;
+	while(node != NULL) {
+		root->update(node);
+		node = node->parent;
+	}
+	return;
+}
+
+void avl_insert(avl_root_t * root, avl_node_t * node, AVLCompareFunc compare_func) {
+	avl_node_t * parent = NULL;
+	avl_node_t * * link = &root->node;
+	while(*link != NULL) {
+		parent = *link;
+		if(compare_func(node, parent) < 0)
+			link = &parent->left;
+		else
+			link = &parent->right;
+	}
+	node->left = NULL;
+	node->right = NULL;
+	node->parent = parent;
+	node->height = 1;
+	*link = node;
+	if(root->update != NULL)
+		root->update(node);
+	avl_rebalance(root, parent);
+	return;
+}
+
+void avl_remove(avl_root_t * root, avl_node_t * node) {
+	avl_node_t * start;
+	if(node->left != NULL && node->right != NULL) {
+		/* Replace the node with its successor, which has no left child */
+		avl_node_t * succ = node->right;
+		while(succ->left != NULL)
+			succ = succ->left;
+		if(succ->parent != node) {
+			start = succ->parent;
+			start->left = succ->right;
+			if(succ->right != NULL)
+				succ->right->parent = start;
+			succ->right = node->right;
+			node->right->parent = succ;
+		}
+		else {
+			start = succ;
+		}
+		succ->left = node->left;
+		node->left->parent = succ;
+		succ->height = node->height;
+		avl_replace_child(root, node->parent, node, succ);
+	}
+	else {
+		avl_node_t * child = (node->left != NULL) ? node->left : node->right;
+		start = node->parent;
+		avl_replace_child(root, node->parent, node, child);
+	}
+	node->left = NULL;
+	node->right = NULL;
+	node->parent = NULL;
+	avl_rebalance(root, start);
+	return;
+}
+
+avl_node_t * avl_first(avl_root_t * root) {
+	avl_node_t * node = root->node;
+	if(node == NULL)
+		return NULL;
+	while(node->left != NULL)
+		node = node->left;
+	return node;
+}
+
+avl_node_t * avl_last(avl_root_t * root) {
+	avl_node_t * node = root->node;
+	if(node == NULL)
+		return NULL;
+	while(node->right != NULL)
+		node = node->right;
+	return node;
+}
+
+avl_node_t * avl_next(avl_node_t * node) {
+	if(node->right != NULL) {
+		node = node->right;
+		while(node->left != NULL)
+			node = node->left;
+		return node;
+	}
+	while(node->parent != NULL && node == node->parent->right)
+		node = node->parent;
+	return node->parent;
+}
+
+avl_node_t * avl_prev(avl_node_t * node) {
+	if(node->left != NULL) {
+		node = node->left;
+		while(node->right != NULL)
+			node = node->right;
+		return node;
+	}
+	while(node->parent != NULL && node == node->parent->left)
+		node = node->parent;
+	return node->parent;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,164 @@
+
+// This file is a part of MRNIU/SimpleKernel (https://github.com/MRNIU/SimpleKernel).
+//
+// avltree.h for MRNIU/SimpleKernel.
+
+#ifndef _AVLTREE_H_
+#define _AVLTREE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stddef.h"
+#include "stdint.h"
+// NOTE!!!
+// 侵入式平衡二叉树，节点嵌入在使用者的结构体中，不申请内存，
+// 所以在 heap_init() 之前也可以使用
+
+/**
+ * A node of an AVL tree. Embed it in the structure to be indexed and use
+ * @ref avl_entry to get back to the containing structure.
+ */
+
+typedef
+    struct avl_node {
+	struct avl_node *	left;
+	struct avl_node *	right;
+	struct avl_node *	parent;
+	int32_t				height;
+} avl_node_t;
+
+/**
+ * Callback function used to keep per-node data derived from the subtree
+ * up to date (e.g. the largest value in the subtree). It is called on a
+ * node after its children have changed, children first.
+ *
+ * @param node        The node to update.
+ */
+
+typedef void (* AVLUpdateFunc)(avl_node_t * node);
+
+/**
+ * The root of an AVL tree. An empty tree has node == NULL.
+ */
+
+typedef
+    struct avl_root {
+	avl_node_t *		node;
+	/* Optional, NULL when the nodes carry no subtree data */
+	AVLUpdateFunc		update;
+} avl_root_t;
+
+/**
+ * Callback function used to order the nodes of a tree.
+ *
+ * @param node1       The first node to compare.
+ * @param node2       The second node to compare.
+ * @return            A negative value if node1 should be sorted before
+ *                    node2, a positive value if node1 should be sorted
+ *                    after node2, zero if node1 and node2 are equal.
+ */
+
+typedef int (* AVLCompareFunc)(avl_node_t * node1, avl_node_t * node2);
+
+/**
+ * Get the structure containing an embedded node.
+ *
+ * @param ptr          Pointer to the embedded @ref avl_node_t.
+ * @param type         Type of the containing structure.
+ * @param member       Name of the node member in the structure.
+ */
+
+#define avl_entry(ptr, type, member) \
+	( (type *)( (uint8_t *)(ptr) - (ptr_t)( &( (type *)0)->member) ) )
+
+/**
+ * Initialise an empty tree.
+ *
+ * @param root         The tree.
+ */
+
+void avl_init_root(avl_root_t * root);
+
+/**
+ * Initialise an empty tree whose nodes carry data derived from their
+ * subtrees.
+ *
+ * @param root         The tree.
+ * @param update_func  Function used to recompute the data of a node.
+ */
+
+void avl_init_root_augmented(avl_root_t * root, AVLUpdateFunc update_func);
+
+/**
+ * Recompute the subtree data from a node up to the root. Call it after
+ * changing a node in place without changing its order in the tree.
+ *
+ * @param root         The tree.
+ * @param node         The changed node.
+ */
+
+void avl_propagate(avl_root_t * root, avl_node_t * node);
+
+/**
+ * Insert a node. Nodes that compare equal are inserted after the
+ * existing ones.
+ *
+ * @param root         The tree.
+ * @param node         The node to insert, must not be in any tree.
+ * @param compare_func Function used to order the nodes.
+ */
+
+void avl_insert(avl_root_t * root, avl_node_t * node, AVLCompareFunc compare_func);
+
+/**
+ * Remove a node from the tree it is in.
+ *
+ * @param root         The tree.
+ * @param node         The node to remove.
+ */
+
+void avl_remove(avl_root_t * root, avl_node_t * node);
+
+/**
+ * Retrieve the smallest node of a tree.
+ *
+ * @param root         The tree.
+ * @return             The first node, or NULL if the tree is empty.
+ */
+
+avl_node_t * avl_first(avl_root_t * root);
+
+/**
+ * Retrieve the largest node of a tree.
+ *
+ * @param root         The tree.
+ * @return             The last node, or NULL if the tree is empty.
+ */
+
+avl_node_t * avl_last(avl_root_t * root);
+
+/**
+ * Retrieve the next node in order.
+ *
+ * @param node         The current node.
+ * @return             The next node, or NULL if this is the last one.
+ */
+
+avl_node_t * avl_next(avl_node_t * node);
+
+/**
+ * Retrieve the previous node in order.
+ *
+ * @param node         The current node.
+ * @return             The previous node, or NULL if this is the first one.
+ */
+
+avl_node_t * avl_prev(avl_node_t * node);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _AVLTREE_H_ */
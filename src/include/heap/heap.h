@@ -29,6 +29,8 @@ typedef
 	ptr_t (* heap_manage_malloc)(size_t byte);
 	// 释放内存
 	void (* heap_manage_free)(ptr_t addr);
+	// 归还最多 pages 页空闲的物理内存，返回实际归还的页数
+	size_t (* heap_manage_shrink)(size_t pages);
 } heap_manage_t;
 
 // 初始化堆
@@ -0,0 +1,40 @@
+
+// This file is a part of MRNIU/SimpleKernel (https://github.com/MRNIU/SimpleKernel).
+//
+// bitmap.h for MRNIU/SimpleKernel.
+
+#ifndef _BITMAP_H_
+#define _BITMAP_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "mem/pmm.h"
+
+// 一个字表示的页数
+#define BITMAP_WORD_BITS    (32)
+// 位图字数，每页一位，1 表示空闲，512MB 共 16KB
+#define BITMAP_WORDS        (PMM_PAGE_MAX_SIZE / BITMAP_WORD_BITS)
+// 摘要字数，每个位图字一位，1 表示该字中有空闲页
+#define BITMAP_SUMMARY_WORDS    ( (BITMAP_WORDS + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS)
+
+// 每个分区的位图信息，位图本身所有分区共用
+typedef
+    struct bitmap_zone {
+	// 分区的起始页帧号
+	uint32_t	pfn_start;
+	// 分区的结束页帧号（不含）
+	uint32_t	pfn_end;
+	// 分区空闲页数量
+	uint32_t	free_pages;
+} bitmap_zone_t;
+
+// 用于管理物理地址
+extern pmm_manage_t bitmap_manage;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _BITMAP_H_ */
@@ -10,6 +10,50 @@
 extern "C" {
 #endif
 
+#include "mem/pmm.h"
+
+// 阶数上限，最大的块为 2^(BUDDY_MAX_ORDER-1) 页，即 4MB
+#define BUDDY_MAX_ORDER     (11)
+// 空链表/无效页帧号
+#define BUDDY_PFN_NONE      (0xFFFFFFFFUL)
+
+// 每个物理页在伙伴系统中的信息
+typedef
+    struct buddy_page {
+	// 同阶空闲链表中的前后页帧号，只有块的首页有效
+	uint32_t	next;
+	uint32_t	prev;
+	// 块的阶数，只有块的首页有效
+	uint8_t		order;
+	// 当前页状态
+	uint8_t		flag;
+} buddy_page_t;
+
+// 同一阶的空闲块链表
+typedef
+    struct buddy_free_area {
+	// 链表头的页帧号
+	uint32_t	head;
+	// 空闲块数量
+	uint32_t	nr_free;
+} buddy_free_area_t;
+
+// 每个分区一个伙伴系统
+typedef
+    struct buddy_zone {
+	// 分区的起始页帧号
+	uint32_t			pfn_start;
+	// 分区的结束页帧号（不含）
+	uint32_t			pfn_end;
+	// 分区空闲页数量
+	uint32_t			free_pages;
+	// 各阶的空闲块
+	buddy_free_area_t	free_area[BUDDY_MAX_ORDER];
+} buddy_zone_t;
+
+// 用于管理物理地址
+extern pmm_manage_t buddy_manage;
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,65 @@
+
+// This file is a part of MRNIU/SimpleKernel (https://github.com/MRNIU/SimpleKernel).
+//
+// cma.h for MRNIU/SimpleKernel.
+
+#ifndef _CMA_H_
+#define _CMA_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "mem/pmm.h"
+
+/***************************
+            连续内存区域
+	启动时在 DMA 分区中预留一段连续内存，驱动通过 cma_alloc() 申请大块连续缓冲区。
+	平时可移动的单页申请在其它内存不足时可以借用其中的空闲页，
+	驱动申请时把借出的页的内容复制到别处，再通知使用者改用新的页。
+****************************/
+// 预留大小，默认 4MB
+#ifndef CMA_SIZE
+#define CMA_SIZE        (0x400000UL)
+#endif
+#define CMA_PAGES       (CMA_SIZE / PMM_PAGE_SIZE)
+
+// 迁移函数，页的内容已经从 old_pa 复制到 new_pa，使用者需要将引用改为 new_pa，成功返回 true
+typedef bool (* cma_migrate_t)(ptr_t old_pa, ptr_t new_pa, void * data);
+
+// 区域中每一页的信息
+typedef
+    struct cma_page {
+	// 借出时的迁移函数与参数
+	cma_migrate_t	migrate;
+	void *			data;
+	// 当前页状态
+	uint8_t			state;
+} cma_page_t;
+
+// 从 DMA 分区预留区域，在 DMA 分区初始化之后调用
+void cma_init(void);
+
+// addr 是否位于区域中
+bool cma_contains(ptr_t addr);
+
+// 归还借出的页
+void cma_release(ptr_t addr);
+
+// 区域中的空闲页数
+uint32_t cma_free_pages_count(void);
+
+// 申请一个可移动的页，flags 允许的分区都不足时借用区域中的页，被迁移时调用 migrate
+ptr_t cma_alloc_movable(uint32_t flags, cma_migrate_t migrate, void * data);
+
+// 从区域中申请连续内存，借出的页会被迁移，用于 DMA 缓冲区
+ptr_t cma_alloc(uint32_t bytes);
+
+// 释放 cma_alloc() 申请的内存
+void cma_free(ptr_t addr, uint32_t bytes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CMA_H_ */
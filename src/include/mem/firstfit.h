@@ -11,6 +11,10 @@ extern "C" {
 #endif
 
 #include "mem/pmm.h"
+#include "include/avltree.h"
+
+// 空闲块按页数分级，第 i 级保存 [2^i, 2^(i+1)) 页的块
+#define FF_BUCKET_MAX   (32)
 // 块
 typedef
     struct chunk_info {
@@ -30,6 +34,13 @@ typedef
 	chunk_info_t			chunk_info;
 	struct list_entry *		next;
 	struct list_entry *		prev;
+	// 按地址排序的索引，包含全部块
+	avl_node_t				addr_node;
+	// 按大小排序的索引，只包含空闲块
+	avl_node_t				size_node;
+	// 同一级空闲块链表
+	struct list_entry *		bucket_next;
+	struct list_entry *		bucket_prev;
 } list_entry_t;
 typedef
     struct firstfit_manage {
@@ -45,6 +56,19 @@ typedef
 	uint32_t node_num;
 	// 空闲链表
 	list_entry_t *		free_list;
+	// 节点存储区，最多 node_max 个节点，前 node_top 个用过
+	list_entry_t *		node_base;
+	uint32_t		node_max;
+	uint32_t		node_top;
+	// 已释放、可复用的节点，通过 next 串起来
+	list_entry_t *		node_free;
+	// 地址索引，用于 free() 查找与合并
+	avl_root_t		addr_tree;
+	// 大小索引，用于 alloc() 最佳适应查找
+	avl_root_t		size_tree;
+	// 分级空闲链表，bucket_mask 的第 i 位表示第 i 级非空
+	list_entry_t *		bucket[FF_BUCKET_MAX];
+	uint32_t		bucket_mask;
 } firstfit_manage_t;
 // 用于管理物理地址
 extern pmm_manage_t firstfit_manage;
@@ -0,0 +1,55 @@
+
+// This file is a part of MRNIU/SimpleKernel (https://github.com/MRNIU/SimpleKernel).
+//
+// memblock.h for MRNIU/SimpleKernel.
+
+#ifndef _MEMBLOCK_H_
+#define _MEMBLOCK_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "mem/pmm.h"
+
+/***************************
+            启动阶段内存分配
+	物理内存管理初始化之前，物理页数组、管理算法的元数据等从这里申请，
+	按地址顺序紧凑地放在可用内存段中，被申请的内存记录为保留，
+	分区初始化时保留的页不会交给管理算法。
+****************************/
+// 可用/保留内存段数量上限
+#define MEMBLOCK_MAX        (32)
+
+typedef
+    struct memblock_region {
+	// 起始物理地址
+	ptr_t		base;
+	// 长度，单位为 Byte
+	uint32_t	size;
+} memblock_region_t;
+
+typedef
+    struct memblock_type {
+	// 按地址排序，互不重叠
+	memblock_region_t	region[MEMBLOCK_MAX];
+	uint32_t			count;
+} memblock_type_t;
+
+// 根据 GRUB 提供的内存信息初始化，并保留 0 号页与内核
+void memblock_init(e820map_t * e820map);
+
+// 将 [base, base + size) 记录为保留，成功返回 true
+bool memblock_reserve(ptr_t base, uint32_t size);
+
+// 申请 size 字节，物理地址按 align 对齐，返回清零的内存的内核线性地址，失败返回 NULL
+ptr_t memblock_alloc(uint32_t size, uint32_t align);
+
+// addr 所在的页是否被保留
+bool memblock_is_reserved(ptr_t addr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _MEMBLOCK_H_ */
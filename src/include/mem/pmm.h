@@ -12,6 +12,7 @@ extern "C" {
 
 #include "stddef.h"
 #include "stdint.h"
+#include "stdbool.h"
 #include "e820.h"
 #include "multiboot2.h"
 
@@ -46,6 +47,9 @@ extern "C" {
 // 页大小 4KB
 #define PMM_PAGE_SIZE    (0x1000UL)
 #endif
+// 大页 4MB，不定义 CPU_PSE 时也可以在运行时申请，按 4MB 对齐
+#define PMM_LARGE_PAGE_SIZE     (0x400000UL)
+#define PMM_LARGE_PAGE_PAGES    (PMM_LARGE_PAGE_SIZE / PMM_PAGE_SIZE)
 /*************************/
 //总共3个区域
 #define zone_sum 3
@@ -109,21 +113,147 @@ typedef struct zone{
 		bool need_balance;
 		//管理区总页数
 		uint32_t all_pages;
+		//物理页数组与管理算法是否已经初始化，延迟初始化时在首次使用前完成
+		bool inited;
 }memory_zone;
-//物理页结构体
+//物理页结构体，全部信息压缩在一个字中，地址由下标得出
+//  bit 0-1  : 该页对应的内存分区 0-zone_DMA 1-zone_NORMAL 2-zone_HIGHMEM
+//  bit 2-7  : 页标志
+//  bit 8-31 : 该页被引用次数
 typedef struct page{
-	//该页对应的内存分区 0-zone_DMA 1-zone_NORMAL 2-zone_HIGHMEM
-	char zone;
-	//起始地址
-	ptr_t start;
-	//该页被引用次数，-1代表外设映射区域，OS无法进行操作
-	uint32_t ref;
+	uint32_t flags;
 }physical_page;
 
+#define PMM_PG_ZONE_MASK    (0x00000003UL)
+// 外设映射或不可用的区域，OS无法进行操作
+#define PMM_PG_RESERVED     (0x00000004UL)
+// 大页的首页，整个大页一起释放
+#define PMM_PG_LARGE        (0x00000008UL)
+#define PMM_PG_FLAG_MASK    (0x000000FCUL)
+#define PMM_PG_REF_SHIFT    (8)
+#define PMM_PG_REF_MAX      (0x00FFFFFFUL)
+
 //分区数组
 memory_zone mem_zone[zone_sum];
-//可用内存的物理页数组
-physical_page mem_page[PMM_PAGE_MAX_SIZE];
+//物理页数组，启动时根据内存大小分配
+extern physical_page * mem_page;
+//物理页数组长度
+extern uint32_t mem_page_count;
+
+static inline uint32_t page_zone(physical_page * page) {
+	return page->flags & PMM_PG_ZONE_MASK;
+}
+
+static inline void page_set_zone(physical_page * page, uint32_t zone) {
+	page->flags = (page->flags & ~PMM_PG_ZONE_MASK) | (zone & PMM_PG_ZONE_MASK);
+}
+
+static inline bool page_flag(physical_page * page, uint32_t flag) {
+	return (page->flags & flag) != 0;
+}
+
+static inline void page_set_flag(physical_page * page, uint32_t flag) {
+	page->flags |= (flag & PMM_PG_FLAG_MASK);
+}
+
+static inline void page_clear_flag(physical_page * page, uint32_t flag) {
+	page->flags &= ~(flag & PMM_PG_FLAG_MASK);
+}
+
+static inline uint32_t page_ref(physical_page * page) {
+	return page->flags >> PMM_PG_REF_SHIFT;
+}
+
+static inline void page_set_ref(physical_page * page, uint32_t ref) {
+	page->flags = (page->flags & (PMM_PG_ZONE_MASK | PMM_PG_FLAG_MASK) ) | (ref << PMM_PG_REF_SHIFT);
+}
+
+// 该页是否可以被分配
+static inline bool page_is_free(physical_page * page) {
+	return page_ref(page) == 0 && !page_flag(page, PMM_PG_RESERVED);
+}
+
+// 物理页与物理地址的转换
+static inline ptr_t page_addr(physical_page * page) {
+	return (ptr_t)(page - mem_page) * PMM_PAGE_SIZE;
+}
+
+static inline physical_page * addr_page(ptr_t addr) {
+	return &mem_page[addr / PMM_PAGE_SIZE];
+}
+/*******************************************************************************/
+/***************************
+            每 CPU 页缓存
+	单页的申请和释放先经过当前 CPU 的缓存，只在缓存空或满时批量访问管理算法，
+	热页为最近释放的页，很可能还在 CPU 缓存中，优先分配；冷页为批量补充来的页。
+****************************/
+// 最大 CPU 数量，目前只有一个
+#define PMM_CPU_MAX         (1)
+
+// 当前 CPU 编号，目前只有一个 CPU
+static inline uint32_t pmm_cpu_id(void) {
+	return 0;
+}
+
+// 热页数量上限，达到后归还最旧的 PMM_PCP_BATCH 页
+#define PMM_PCP_HIGH        (64)
+// 每次批量补充/归还的页数
+#define PMM_PCP_BATCH       (16)
+
+typedef
+    struct pmm_pcp {
+	// 热页，环形队列，从尾部进出，从头部归还
+	ptr_t		hot[PMM_PCP_HIGH];
+	uint32_t	hot_head;
+	uint32_t	hot_count;
+	// 冷页，栈
+	ptr_t		cold[PMM_PCP_BATCH];
+	uint32_t	cold_count;
+} pmm_pcp_t;
+
+// 每个分区的清零页池容量，空闲时补充
+#define PMM_ZERO_POOL_MAX   (32)
+
+typedef
+    struct pmm_zero_pool {
+	// 已经清零的页，栈
+	ptr_t		page[PMM_ZERO_POOL_MAX];
+	uint32_t	count;
+} pmm_zero_pool_t;
+/*******************************************************************************/
+/***************************
+            统计信息
+	每个 CPU 分别计数，不关中断也不加锁，读取时再求和，
+	空闲块分布与碎片指数在读取时由管理算法现场统计。
+****************************/
+// 申请/释放/失败都按页计数，不论一次申请多少页
+#define PMM_STAT_ALLOC      (0)
+#define PMM_STAT_FREE       (1)
+#define PMM_STAT_FAIL       (2)
+// 大块拆分/相邻空闲块合并的次数，由管理算法计数
+#define PMM_STAT_SPLIT      (3)
+#define PMM_STAT_MERGE      (4)
+#define PMM_STAT_MAX        (5)
+// 空闲块分布的级数，第 i 级为 [2^i, 2^(i+1)) 页，最后一级包含更大的块
+#define PMM_FRAG_ORDER      (11)
+
+typedef
+    struct pmm_stat {
+	uint32_t	count[PMM_STAT_MAX];
+} pmm_stat_t;
+
+typedef
+    struct pmm_frag {
+	// 各级空闲块的数量与总页数
+	uint32_t	blocks[PMM_FRAG_ORDER];
+	uint32_t	pages[PMM_FRAG_ORDER];
+} pmm_frag_t;
+
+// 页数对应的级别
+static inline uint32_t pmm_frag_order(uint32_t pages) {
+	uint32_t order = 31 - __builtin_clz(pages);
+	return (order < PMM_FRAG_ORDER) ? order : PMM_FRAG_ORDER - 1;
+}
 /*******************************************************************************/
 // 内存管理结构体
 typedef
@@ -132,12 +262,20 @@ typedef
 	const char *      name;
 	// 初始化
 	void (* pmm_manage_init)();
+	// 初始化一个分区，调用前该分区的物理页数组已经初始化
+	void (* pmm_manage_zone_init)(char zone);
 	// 申请物理内存，单位为 Byte
 	ptr_t (* pmm_manage_alloc)(uint32_t bytes,char zone);
 	// 释放内存页
 	void (* pmm_manage_free)(ptr_t addr_start, uint32_t bytes,char zone);
 	// 返回当前可用内存页数量
 	uint32_t (* pmm_manage_free_pages_count)(char zone);
+	// 申请 n 个不要求连续的页，返回实际申请到的数量，可以为 NULL
+	uint32_t (* pmm_manage_alloc_bulk)(char zone, uint32_t n, ptr_t * frames);
+	// 申请起始地址按 align 对齐的物理内存，align 为页大小的 2 的幂倍
+	ptr_t (* pmm_manage_alloc_align)(uint32_t bytes, uint32_t align, char zone);
+	// 统计 zone 分区的空闲块分布
+	void (* pmm_manage_frag)(char zone, pmm_frag_t * frag);
 } pmm_manage_t;
 
 // 物理内存初始化
@@ -146,13 +284,95 @@ void pmm_phy_init(e820map_t * e820map);
 void pmm_mamage_init();
 // 初始化内存管理
 void pmm_init(void);
+// 在 task_init() 之后调用，创建初始化剩余分区与平衡分区的内核线程
+void pmm_init_late(void);
 
 ptr_t pmm_alloc(size_t byte,char zone);
 
+// 申请标志，低三位表示可以使用的分区
+#define PMM_ZONE_FLAG(zone) (1UL << (zone) )
+#define PMM_ZONE_DMA        PMM_ZONE_FLAG(DMA)
+#define PMM_ZONE_NORMAL     PMM_ZONE_FLAG(NORMAL)
+#define PMM_ZONE_HIGHMEM    PMM_ZONE_FLAG(HIGHMEM)
+// 失败时不回收重试，直接返回 NULL，用于对延迟敏感的路径
+#define PMM_NORETRY         (1UL << 3)
+// 返回清零的内存，单页申请优先从清零页池中取
+#define PMM_ZERO            (1UL << 4)
+// 内核一般使用，任何分区都可以
+#define PMM_KERNEL          (PMM_ZONE_NORMAL | PMM_ZONE_HIGHMEM | PMM_ZONE_DMA)
+// DMA 作为后备分区时，申请后至少保留 1/PMM_DMA_RESERVE_RATIO 给设备使用
+#define PMM_DMA_RESERVE_RATIO   (4)
+
+// 按 NORMAL -> HIGHMEM -> DMA 的顺序，在 flags 允许的分区中申请
+ptr_t pmm_alloc_flags(size_t byte, uint32_t flags);
+
 void pmm_free_page(ptr_t addr, uint32_t byte,char zone);
 
+// 释放内存，分区由地址得出
+void pmm_free(ptr_t addr, uint32_t byte);
+
+// 申请一个 4MB 对齐的大页，flags 同 pmm_alloc_flags()，用于 PSE 映射
+ptr_t pmm_alloc_large(uint32_t flags);
+
+// 释放 pmm_alloc_large() 申请的大页
+void pmm_free_large(ptr_t addr);
+
+// 从 zone 分区申请 n 个不要求连续的页，存入 frames，返回实际申请到的数量
+uint32_t pmm_alloc_bulk(char zone, uint32_t n, ptr_t * frames);
+
+// 释放 frames 中的 n 个页，分区由地址得出
+void pmm_free_bulk(uint32_t n, ptr_t * frames);
+
+// 物理页的引用计数，申请到的每一页引用计数为 1，释放后为 0，大页只使用首页的计数
+// 共享物理页时增加引用计数
+void page_get(physical_page * page);
+
+// 减少引用计数，减为 0 时释放该页
+void page_put(physical_page * page);
+
 uint32_t pmm_free_pages_count(char zone);
 
+// 将当前 CPU 缓存的 zone 分区的页全部归还给管理算法
+void pmm_pcp_drain(char zone);
+
+// 在空闲循环中调用，每次完成一项工作：初始化一个延迟的分区、平衡一个分区
+// 或清零一页放入清零页池，都不需要时返回 false
+// 调度器启用前 pmm_init_late() 的线程不能运行，由这里代替
+bool pmm_idle(void);
+
+// 当前 CPU 的 zone 分区计数加一
+void pmm_stat_inc(char zone, uint32_t item);
+
+// 各 CPU 计数之和
+void pmm_stat_get(char zone, pmm_stat_t * stat);
+
+// zone 分区的空闲块分布
+void pmm_frag_get(char zone, pmm_frag_t * frag);
+
+// 碎片指数，0-100，空闲页中不能满足 2^order 页申请的比例
+uint32_t pmm_frag_index(char zone, uint32_t order);
+
+// 输出各分区的统计信息，申请失败（非 PMM_NORETRY）时也会调用
+void pmm_stat_print(void);
+
+/*******************************************************************************/
+/***************************
+            分区平衡
+	管理算法中的空闲页低于 pages_low 时设置 need_balance，由平衡线程依次调用
+	注册的回收函数，直到空闲页回到 pages_high 之上；申请失败时直接回收一次再重试。
+****************************/
+// 最多可注册的回收函数数量
+#define PMM_SHRINKER_MAX    (8)
+
+// 回收函数，尽量为 zone 分区归还 pages 页，返回实际归还的页数
+typedef uint32_t (* pmm_shrinker_t)(char zone, uint32_t pages);
+
+// 注册回收函数，成功返回 true
+bool pmm_shrinker_register(pmm_shrinker_t shrinker);
+
+// 回收 zone 分区，直到空闲页不低于 pages_high 或没有可回收的页
+void pmm_balance(char zone);
+
 #ifdef __cplusplus
 }
 #endif
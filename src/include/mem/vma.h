@@ -0,0 +1,87 @@
+
+// This file is a part of MRNIU/SimpleKernel (https://github.com/MRNIU/SimpleKernel).
+//
+// vma.h for MRNIU/SimpleKernel.
+
+#ifndef _VMA_H_
+#define _VMA_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stdint.h"
+#include "stddef.h"
+#include "stdbool.h"
+#include "include/avltree.h"
+
+/***************************
+            虚拟内存区域
+	描述地址空间中一段连续的、属性相同的虚拟地址 [start, end)，
+	每个地址空间的区域互不重叠，按起始地址放在 AVL 树中，
+	另外记录上次查找到的区域，连续访问同一区域时不用查找。
+	每个节点记录子树中最长区域的长度，可以按长度查找，用于管理空闲地址。
+****************************/
+// 区域属性
+#define VMA_READ        (0x00000001)
+#define VMA_WRITE       (0x00000002)
+#define VMA_EXEC        (0x00000004)
+// 匿名内存，缺页时分配清零的物理页，用于堆、栈与 BSS
+#define VMA_ANON        (0x00000008)
+// 用户可以访问
+#define VMA_USER        (0x00000010)
+
+typedef
+    struct vma {
+	// 起止地址，按页对齐
+	ptr_t			start;
+	ptr_t			end;
+	uint32_t		flags;
+	// AVL 树，按起始地址排序
+	avl_node_t		node;
+	// 子树中最长区域的长度，由树的更新函数维护
+	size_t			max_size;
+} vma_t;
+
+typedef
+    struct vma_set {
+	avl_root_t	root;
+	// 上次查找到的区域
+	vma_t *		cache;
+	// 区域数量
+	uint32_t	count;
+} vma_set_t;
+
+// 初始化为空
+void vma_set_init(vma_set_t * set);
+
+// 释放全部区域
+void vma_set_destroy(vma_set_t * set);
+
+// 复制 src 中的全部区域到空的 dst，成功返回 true
+bool vma_set_copy(vma_set_t * dst, vma_set_t * src);
+
+// 返回包含 addr 的区域，没有时返回 NULL
+vma_t * vma_find(vma_set_t * set, ptr_t addr);
+
+// 返回第一个 end 大于 addr 的区域，即包含 addr 或者在 addr 之后的第一个区域
+vma_t * vma_find_next(vma_set_t * set, ptr_t addr);
+
+// 返回长度不小于 size 的区域中地址最低的一个，没有时返回 NULL
+vma_t * vma_find_size(vma_set_t * set, size_t size);
+
+// 添加区域 [start, end)，与已有区域重叠时失败，与属性相同的相邻区域合并
+// 返回包含 [start, end) 的区域
+vma_t * vma_insert(vma_set_t * set, ptr_t start, ptr_t end, uint32_t flags);
+
+// 在 addr 处把 vma 分为两段，返回后一段
+vma_t * vma_split(vma_set_t * set, vma_t * vma, ptr_t addr);
+
+// 删除 [start, end) 中的区域，部分重叠的区域被分割，返回删除的字节数
+size_t vma_remove(vma_set_t * set, ptr_t start, ptr_t end);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _VMA_H_ */
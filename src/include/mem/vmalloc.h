@@ -0,0 +1,44 @@
+
+// This file is a part of MRNIU/SimpleKernel (https://github.com/MRNIU/SimpleKernel).
+//
+// vmalloc.h for MRNIU/SimpleKernel.
+
+#ifndef _VMALLOC_H_
+#define _VMALLOC_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stdint.h"
+#include "stddef.h"
+#include "heap/heap.h"
+
+/***************************
+            内核虚拟地址分配
+	物理页不连续、虚拟地址连续的内核内存从这段地址中分配，
+	空闲地址段按地址放在 vma_set_t 中，按长度查找地址最低的空闲段，
+	申请到物理页后一次映射整段，每段之后留一页不映射，越界访问会触发缺页。
+	整个地址段的页表在初始化时建立，复制的页目录与内核共享这些页表。
+	树的节点来自堆，所以堆使用自己的地址段，位于这段地址之前。
+****************************/
+#define VMALLOC_START       (HEAP_START + HEAP_MAX_SIZE)
+#ifndef VMALLOC_SIZE
+#define VMALLOC_SIZE        (0x10000000UL)
+#endif
+#define VMALLOC_END         (VMALLOC_START + VMALLOC_SIZE)
+
+// 初始化，在堆初始化之后调用
+void vmalloc_init(void);
+
+// 申请 byte 字节，按页向上取整，内容不清零，失败返回 NULL
+ptr_t vmalloc(size_t byte);
+
+// 释放 vmalloc() 申请的内存，byte 与申请时相同
+void vfree(ptr_t addr, size_t byte);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _VMALLOC_H_ */
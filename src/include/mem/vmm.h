@@ -50,6 +50,11 @@ extern "C" {
 #define VMM_PAGE_TABLES_KERNEL      ( (KERNEL_SIZE / VMM_PAGE_TABLE_SIZE) + 1UL)
 // 映射内核需要的页目录数
 #define VMM_PAGE_DIRECTORIES_KERNEL      ( (KERNEL_SIZE / VMM_PAGE_DIRECTORY_SIZE) + 1UL)
+// 线性映射区大小，物理地址 [0, VMM_LINEAR_SIZE) 映射到从 KERNEL_BASE 开始的虚拟地址，
+// 包括内核本身，物理内存管理的所有页都在其中，内核通过 VMM_PA_LA() 访问物理页
+#define VMM_LINEAR_SIZE     (PMM_MAX_SIZE)
+// 映射线性区需要的页表数
+#define VMM_PAGE_TABLES_LINEAR      (VMM_LINEAR_SIZE / VMM_PAGE_TABLE_SIZE)
 
 // P = 1 表示有效； P = 0 表示无效。
 #define VMM_PAGE_PRESENT    (0x00000001)
@@ -63,6 +68,50 @@ extern "C" {
 // 如果为 0  那么页面只能被运行在超级用户特权级 (0,1 或 2)  的程序访问。
 #define VMM_PAGE_KERNEL     (0x00000000)
 
+// PS-- 位 7 只在页目录项中有效，开启 CR4.PSE 后为 1 表示该项直接映射 4MB 页
+#define VMM_PAGE_PSE        (0x00000080)
+
+// G-- 位 8 为 1 表示全局页，开启 CR4.PGE 后切换页目录时不会从 TLB 中清除
+// 只用于在所有页目录中都相同的内核映射
+#define VMM_PAGE_GLOBAL     (0x00000100)
+
+// AVL-- 位 9~11 留给软件使用
+// 位 9 为 1 表示写时复制，页表项只读，写入时复制一份再改为可写
+#define VMM_PAGE_COW        (0x00000200)
+
+// 缺页错误码
+// P-- 位 0 为 0 表示页不存在，为 1 表示违反了页的权限
+#define VMM_PF_PRESENT      (0x00000001)
+// W-- 位 1 为 1 表示写操作
+#define VMM_PF_WRITE        (0x00000002)
+// U-- 位 2 为 1 表示在用户模式发生
+#define VMM_PF_USER         (0x00000004)
+// 位 3 为 1 表示页表项的保留位被置位
+#define VMM_PF_RESERVED     (0x00000008)
+// 位 4 为 1 表示发生在取指令时
+#define VMM_PF_FETCH        (0x00000010)
+
+// 一次修改的页数超过此值时重新加载 CR3，而不是逐页 invlpg
+#ifndef VMM_INVLPG_MAX
+#define VMM_INVLPG_MAX      (32)
+#endif
+
+// PCID，编译时定义 VMM_PCID 开启，只能在 IA-32e 模式下使用
+// 每个页目录从一个很小的池中分配 PCID，切换页目录时保留它在 TLB 中的缓存
+#if defined(VMM_PCID) && !defined(__x86_64__)
+#undef VMM_PCID
+#endif
+#ifdef VMM_PCID
+// PCID 数量，0 号不分配
+#define VMM_PCID_MAX        (16)
+// 写入 CR3 时位 63 为 1 表示不清除该 PCID 的缓存
+#define VMM_CR3_NOFLUSH     (1UL << 63)
+#endif
+
+// 4MB 页的大小与掩码
+#define VMM_PSE_SIZE        (PMM_LARGE_PAGE_SIZE)
+#define VMM_PSE_MASK        (0xFFC00000UL)
+
 // 获取一个地址的页目录，高 10 位
 #define VMM_PGD_INDEX(x)        ( ( (x) >> 22) & 0x03FF)
 
@@ -84,18 +133,50 @@ typedef ptr_t pud_t;
 // 页表项
 typedef ptr_t pte_t;
 
+/***************************
+            页表页缓存
+	页目录与页表使用的页先从当前 CPU 的缓存中取，缓存中的页都已经清零，
+	释放地址空间时页表项已经逐项清除，页表页直接放回缓存，缓存满了才归还。
+****************************/
+#define VMM_QUICKLIST_MAX   (32)
+// 页目录与页表从这些分区申请，内核通过线性映射区访问，所以必须位于其中
+#define VMM_PT_ZONES        (PMM_KERNEL)
+
+typedef
+    struct vmm_quicklist {
+	// 已经清零的页，栈
+	ptr_t		page[VMM_QUICKLIST_MAX];
+	uint32_t	count;
+} vmm_quicklist_t;
+
 // 内核页目录区域
 extern pgd_t pgd_kernel[VMM_PAGE_TABLES_PRE_PAGE_DIRECTORY] __attribute__( (aligned(VMM_PAGE_SIZE) ) );
 
 // 初始化虚拟内存管理
 void vmm_init(void);
 
+// 申请一页清零的页目录或页表，返回物理地址，失败返回 NULL
+ptr_t vmm_pt_alloc(void);
+
+// 释放页目录或页表，调用者需要保证其中的项已经全部清零
+void vmm_pt_free(ptr_t pa);
+
 // 使用 flags 指出的页权限，把物理地址 pa 映射到虚拟地址 va
 void map(pgd_t * pgd_now, ptr_t va, ptr_t pa, uint32_t flags);
 
 // 取消虚拟地址 va 的物理映射
 void unmap(pgd_t * pgd_now, ptr_t va);
 
+// 把从 pa 开始的 pages 个连续物理页映射到 va，页表不存在时自动申请
+// 返回成功映射的页数
+size_t map_range(pgd_t * pgd_now, ptr_t va, ptr_t pa, size_t pages, uint32_t flags);
+
+// 取消从 va 开始的 pages 页的映射
+void unmap_range(pgd_t * pgd_now, ptr_t va, size_t pages);
+
+// 为 [start, end) 预先申请页表，用于之后才映射的内核地址段，成功返回 true
+bool vmm_prealloc_pte(pgd_t * pgd_now, ptr_t start, ptr_t end);
+
 // 如果虚拟地址 va 映射到物理地址则返回 1
 // 同时如果 pa 不是空指针则把物理地址写入 pa 参数
 uint32_t get_mapping(pgd_t * pgd_now, ptr_t va, ptr_t * pa);
@@ -103,11 +184,22 @@ uint32_t get_mapping(pgd_t * pgd_now, ptr_t va, ptr_t * pa);
 // 更换当前页目录
 void switch_pgd(ptr_t pd);
 
+// 复制页目录，与内核页目录相同的项直接共享，其余映射的物理页由两者只读共享，
+// 写入时在缺页处理中复制，返回新页目录的内核线性地址，失败返回 NULL
+pgd_t * vmm_copy_pgd(pgd_t * pgd_src);
+
+// 释放 vmm_copy_pgd() 得到的页目录，及其中非内核部分的页表与物理页
+void vmm_free_pgd(pgd_t * pgd_now);
+
+// 刷新 TLB 中的全部映射，包括全局页，修改内核映射后使用
+void flush_tlb_all(void);
+
 // 初始化内核页目录
 void vmm_kernel_init(pgd_t * pgd);
 
-#define VMM_LA_PA(la) (la - KERNEL_BASE)
-#define VMM_PA_LA(pa) (pa + KERNEL_BASE)
+// 线性映射区中内核线性地址与物理地址的转换
+#define VMM_LA_PA(la) ( (la) - KERNEL_BASE)
+#define VMM_PA_LA(pa) ( (pa) + KERNEL_BASE)
 
 #ifdef __cplusplus
 }
@@ -14,6 +14,7 @@ extern "C" {
 #include "types.h"
 #include "mem/pmm.h"
 #include "mem/vmm.h"
+#include "mem/vma.h"
 #include "intr/include/intr.h"
 #include "include/linkedlist.h"
 
@@ -24,6 +25,10 @@ extern "C" {
 // 任务栈大小
 #define TASK_STACK_SIZE KERNEL_STACK_SIZE
 
+// do_fork() 的 flags
+// 复制当前任务的地址空间，物理页写时复制，不设置时与当前任务共享地址空间
+#define TASK_FORK_COW   (0x00000001)
+
 // 进程状态描述
 typedef
     enum task_status {
@@ -74,11 +79,16 @@ typedef
 	// 代码段起止
 	ptr_t		code_start;
 	ptr_t		code_end;
-	// 数据段起止
+	// 数据段起止，包括 BSS
 	ptr_t		data_start;
 	ptr_t		data_end;
+	// 堆起止
+	ptr_t		heap_start;
+	ptr_t		heap_end;
 	// 内存结束
 	ptr_t		task_end;
+	// 已映射或保留的虚拟内存区域
+	vma_set_t	vma;
 } task_mem_t;
 
 // 进程控制块 PCB
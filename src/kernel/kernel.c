@@ -37,9 +37,9 @@ void kernel_main(ptr_t magic, ptr_t addr) {
 		// 物理内存初始化
 		pmm_init();
 		// 虚拟内存初始化
-		//vmm_init();
+		vmm_init();
 		// 堆初始化
-		//heap_init();
+		heap_init();
 		// 任务初始化
 		//task_init();
 		// 调度初始化
@@ -47,7 +47,13 @@ void kernel_main(ptr_t magic, ptr_t addr) {
 
 		// showinfo();
 		test();
-		while(1);
+		// 空闲时完成物理内存的后台工作，包括分区平衡与清零页池，
+		// 没有工作时开中断等待，之后保持开中断
+		while(1) {
+			if(!pmm_idle() ) {
+				cpu_idle();
+			}
+		}
 	}
 	local_intr_restore(intr_flag);
 
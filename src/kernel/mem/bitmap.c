@@ -0,0 +1,289 @@
+
+// This file is a part of MRNIU/SimpleKernel (https://github.com/MRNIU/SimpleKernel).
+//
+// bitmap.c for MRNIU/SimpleKernel.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stdint.h"
+#include "stdio.h"
+#include "string.h"
+#include "assert.h"
+#include "mem/bitmap.h"
+
+static void init();
+static void zone_init(char zone);
+static ptr_t alloc(uint32_t bytes, char zone);
+static void free(ptr_t addr_start, uint32_t bytes, char zone);
+static uint32_t free_pages_count(char zone);
+static uint32_t alloc_bulk(char zone, uint32_t n, ptr_t * frames);
+static ptr_t alloc_align(uint32_t bytes, uint32_t align, char zone);
+static void frag(char zone, pmm_frag_t * frag);
+
+pmm_manage_t bitmap_manage = {
+	"Bitmap",
+	&init,
+	&zone_init,
+	&alloc,
+	&free,
+	&free_pages_count,
+	&alloc_bulk,
+	&alloc_align,
+	&frag
+};
+
+// 每页一位，1 表示空闲
+static uint32_t bitmap_map[BITMAP_WORDS];
+// 每个位图字一位，1 表示该字不全为 0，用于跳过已经分配满的字
+static uint32_t bitmap_summary[BITMAP_SUMMARY_WORDS];
+// 三个分区的位图信息
+static bitmap_zone_t bitmap_zone[zone_sum];
+
+// 位图字变化后更新摘要
+static inline void summary_update(uint32_t word);
+// 将 [pfn, pfn + pages) 标记为空闲/已用
+static void range_mark(uint32_t pfn, uint32_t pages, bool free);
+// 返回 [pfn, end) 中第一个空闲页，没有则返回 end
+static uint32_t find_free(uint32_t pfn, uint32_t end);
+// 返回 [pfn, end) 中第一个已用页，没有则返回 end
+static uint32_t find_used(uint32_t pfn, uint32_t end);
+
+void summary_update(uint32_t word) {
+	if(bitmap_map[word] != 0) {
+		bitmap_summary[word / BITMAP_WORD_BITS] |= (1UL << (word % BITMAP_WORD_BITS) );
+	}
+	else {
+		bitmap_summary[word / BITMAP_WORD_BITS] &= ~(1UL << (word % BITMAP_WORD_BITS) );
+	}
+	return;
+}
+
+// 按字处理，整字一次完成
+void range_mark(uint32_t pfn, uint32_t pages, bool free) {
+	while(pages > 0) {
+		uint32_t word = pfn / BITMAP_WORD_BITS;
+		uint32_t bit = pfn % BITMAP_WORD_BITS;
+		uint32_t count = BITMAP_WORD_BITS - bit;
+		if(count > pages) {
+			count = pages;
+		}
+		uint32_t mask = (count == BITMAP_WORD_BITS) ? 0xFFFFFFFFUL : ( ( (1UL << count) - 1) << bit);
+		if(free) {
+			bitmap_map[word] |= mask;
+		}
+		else {
+			bitmap_map[word] &= ~mask;
+		}
+		summary_update(word);
+		pfn += count;
+		pages -= count;
+	}
+	return;
+}
+
+// 先在当前字中找，找不到再通过摘要找下一个有空闲页的字，两次 bsf 即可
+uint32_t find_free(uint32_t pfn, uint32_t end) {
+	if(pfn >= end) {
+		return end;
+	}
+	uint32_t word = pfn / BITMAP_WORD_BITS;
+	uint32_t bits = bitmap_map[word] & (0xFFFFFFFFUL << (pfn % BITMAP_WORD_BITS) );
+	if(bits != 0) {
+		pfn = word * BITMAP_WORD_BITS + __builtin_ctz(bits);
+		return (pfn < end) ? pfn : end;
+	}
+	word++;
+	while(word * BITMAP_WORD_BITS < end) {
+		uint32_t idx = word / BITMAP_WORD_BITS;
+		uint32_t summary = bitmap_summary[idx] & (0xFFFFFFFFUL << (word % BITMAP_WORD_BITS) );
+		if(summary != 0) {
+			word = idx * BITMAP_WORD_BITS + __builtin_ctz(summary);
+			pfn = word * BITMAP_WORD_BITS + __builtin_ctz(bitmap_map[word]);
+			return (pfn < end) ? pfn : end;
+		}
+		word = (idx + 1) * BITMAP_WORD_BITS;
+	}
+	return end;
+}
+
+uint32_t find_used(uint32_t pfn, uint32_t end) {
+	if(pfn >= end) {
+		return end;
+	}
+	uint32_t word = pfn / BITMAP_WORD_BITS;
+	uint32_t bits = ~bitmap_map[word] & (0xFFFFFFFFUL << (pfn % BITMAP_WORD_BITS) );
+	while(bits == 0) {
+		word++;
+		if(word * BITMAP_WORD_BITS >= end) {
+			return end;
+		}
+		bits = ~bitmap_map[word];
+	}
+	pfn = word * BITMAP_WORD_BITS + __builtin_ctz(bits);
+	return (pfn < end) ? pfn : end;
+}
+
+void init() {
+	bzero(bitmap_map, sizeof(bitmap_map) );
+	bzero(bitmap_summary, sizeof(bitmap_summary) );
+	bzero(bitmap_zone, sizeof(bitmap_zone) );
+	return;
+}
+
+void zone_init(char zone) {
+	const ptr_t zone_addr[zone_sum + 1] = {
+		DMA_start_addr, NORMAL_start_addr, HIGHMEM_start_addr, PMM_MAX_SIZE
+	};
+	uint32_t z = (uint8_t)zone;
+	bitmap_zone_t * bz = &bitmap_zone[z];
+	bz->pfn_start = zone_addr[z] / PMM_PAGE_SIZE;
+	bz->pfn_end = zone_addr[z + 1] / PMM_PAGE_SIZE;
+	// 只管理实际存在的内存
+	if(bz->pfn_end > mem_page_count) {
+		bz->pfn_end = mem_page_count;
+	}
+	if(bz->pfn_start > bz->pfn_end) {
+		bz->pfn_start = bz->pfn_end;
+	}
+	bz->free_pages = 0;
+	range_mark(bz->pfn_start, bz->pfn_end - bz->pfn_start, false);
+	// 0 号页保留，否则分配出的地址会与 NULL 相同
+	uint32_t pfn = (bz->pfn_start == 0) ? 1 : bz->pfn_start;
+	while(pfn < bz->pfn_end) {
+		if(!page_is_free(&mem_page[pfn]) ) {
+			pfn++;
+			continue;
+		}
+		uint32_t run = pfn;
+		while(run < bz->pfn_end && page_is_free(&mem_page[run]) ) {
+			run++;
+		}
+		range_mark(pfn, run - pfn, true);
+		bz->free_pages += run - pfn;
+		pfn = run;
+	}
+	return;
+}
+
+// 首次适应，从分区开头找第一段足够长的连续空闲页
+ptr_t alloc(uint32_t bytes, char zone) {
+	// 计算需要的页数
+	uint32_t pages = bytes / PMM_PAGE_SIZE;
+	// 不足一页的+1
+	if(bytes % PMM_PAGE_SIZE != 0) {
+		pages++;
+	}
+	bitmap_zone_t * bz = &bitmap_zone[(uint8_t)zone];
+	if(pages == 0 || bz->free_pages < pages) {
+		printk_err("Error at bitmap.c: ptr_t alloc(uint32_t)\n");
+		return (ptr_t)NULL;
+	}
+	uint32_t pfn = find_free(bz->pfn_start, bz->pfn_end);
+	while(pfn + pages <= bz->pfn_end) {
+		// 空闲段的结尾
+		uint32_t end = find_used(pfn, pfn + pages);
+		if(end == pfn + pages) {
+			range_mark(pfn, pages, false);
+			bz->free_pages -= pages;
+			return (ptr_t)pfn * PMM_PAGE_SIZE;
+		}
+		pfn = find_free(end, bz->pfn_end);
+	}
+	printk_err("Error at bitmap.c: ptr_t alloc(uint32_t)\n");
+	return (ptr_t)NULL;
+}
+
+void free(ptr_t addr_start, uint32_t bytes, char zone) {
+	// 计算需要的页数
+	uint32_t pages = bytes / PMM_PAGE_SIZE;
+	// 不足一页的+1
+	if(bytes % PMM_PAGE_SIZE != 0) {
+		pages++;
+	}
+	bitmap_zone_t * bz = &bitmap_zone[(uint8_t)zone];
+	uint32_t pfn = addr_start / PMM_PAGE_SIZE;
+	if(pages == 0 || pfn < bz->pfn_start || pfn + pages > bz->pfn_end) {
+		printk_err("Error at bitmap.c: void free(ptr_t)\n");
+		return;
+	}
+	// 不能释放空闲页
+	if(find_free(pfn, pfn + pages) != pfn + pages) {
+		printk_err("Error at bitmap.c: void free(ptr_t)\n");
+		return;
+	}
+	range_mark(pfn, pages, true);
+	bz->free_pages += pages;
+	return;
+}
+
+// 不要求连续，一个字中的空闲页一次取完
+uint32_t alloc_bulk(char zone, uint32_t n, ptr_t * frames) {
+	bitmap_zone_t * bz = &bitmap_zone[(uint8_t)zone];
+	uint32_t count = 0;
+	uint32_t pfn = find_free(bz->pfn_start, bz->pfn_end);
+	while(count < n && pfn < bz->pfn_end) {
+		uint32_t word = pfn / BITMAP_WORD_BITS;
+		uint32_t bits = bitmap_map[word] & (0xFFFFFFFFUL << (pfn % BITMAP_WORD_BITS) );
+		uint32_t taken = 0;
+		while(bits != 0 && count < n) {
+			uint32_t bit = __builtin_ctz(bits);
+			if(word * BITMAP_WORD_BITS + bit >= bz->pfn_end) {
+				break;
+			}
+			frames[count++] = (ptr_t)(word * BITMAP_WORD_BITS + bit) * PMM_PAGE_SIZE;
+			taken |= (1UL << bit);
+			bits &= bits - 1;
+		}
+		bitmap_map[word] &= ~taken;
+		summary_update(word);
+		pfn = find_free( (word + 1) * BITMAP_WORD_BITS, bz->pfn_end);
+	}
+	bz->free_pages -= count;
+	return count;
+}
+
+// 与 alloc() 相同，只是每次从对齐的页开始检查
+ptr_t alloc_align(uint32_t bytes, uint32_t align, char zone) {
+	uint32_t pages = (bytes + PMM_PAGE_SIZE - 1) / PMM_PAGE_SIZE;
+	uint32_t step = align / PMM_PAGE_SIZE;
+	bitmap_zone_t * bz = &bitmap_zone[(uint8_t)zone];
+	if(pages == 0 || step == 0 || (step & (step - 1) ) != 0 || bz->free_pages < pages) {
+		printk_err("Error at bitmap.c: ptr_t alloc_align(uint32_t, uint32_t)\n");
+		return (ptr_t)NULL;
+	}
+	uint32_t pfn = find_free(bz->pfn_start, bz->pfn_end);
+	while( (pfn = (pfn + step - 1) & ~(step - 1) ) + pages <= bz->pfn_end) {
+		uint32_t end = find_used(pfn, pfn + pages);
+		if(end == pfn + pages) {
+			range_mark(pfn, pages, false);
+			bz->free_pages -= pages;
+			return (ptr_t)pfn * PMM_PAGE_SIZE;
+		}
+		pfn = find_free(end, bz->pfn_end);
+	}
+	printk_err("Error at bitmap.c: ptr_t alloc_align(uint32_t, uint32_t)\n");
+	return (ptr_t)NULL;
+}
+
+// 位图中没有块，连续的空闲页算作一块
+void frag(char zone, pmm_frag_t * frag) {
+	bitmap_zone_t * bz = &bitmap_zone[(uint8_t)zone];
+	uint32_t pfn = find_free(bz->pfn_start, bz->pfn_end);
+	while(pfn < bz->pfn_end) {
+		uint32_t end = find_used(pfn, bz->pfn_end);
+		frag->blocks[pmm_frag_order(end - pfn)]++;
+		frag->pages[pmm_frag_order(end - pfn)] += end - pfn;
+		pfn = find_free(end, bz->pfn_end);
+	}
+	return;
+}
+
+uint32_t free_pages_count(char zone) {
+	return bitmap_zone[(uint8_t)zone].free_pages;
+}
+
+#ifdef __cplusplus
+}
+#endif
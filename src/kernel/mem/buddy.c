@@ -0,0 +1,293 @@
+
+// This file is a part of MRNIU/SimpleKernel (https://github.com/MRNIU/SimpleKernel).
+//
+// buddy.c for MRNIU/SimpleKernel.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stdint.h"
+#include "stdio.h"
+#include "string.h"
+#include "assert.h"
+#include "mem/memblock.h"
+#include "mem/buddy.h"
+
+#define BUDDY_USED      (0x00)
+#define BUDDY_FREE      (0x01)
+// 不属于伙伴系统的页（外设映射、内核等）
+#define BUDDY_RESERVED  (0x02)
+// 空闲块中首页之外的页，释放这些页说明重复释放
+#define BUDDY_FREE_TAIL (0x03)
+
+static void init();
+static void zone_init(char zone);
+static ptr_t alloc(uint32_t bytes, char zone);
+static void free(ptr_t addr_start, uint32_t bytes, char zone);
+static uint32_t free_pages_count(char zone);
+static ptr_t alloc_align(uint32_t bytes, uint32_t align, char zone);
+static void frag(char zone, pmm_frag_t * frag);
+
+pmm_manage_t buddy_manage = {
+	"Buddy",
+	&init,
+	&zone_init,
+	&alloc,
+	&free,
+	&free_pages_count,
+	NULL,
+	&alloc_align,
+	&frag
+};
+
+// 每个物理页的伙伴信息，按实际内存大小从 memblock 申请
+static buddy_page_t * buddy_page = NULL;
+// 三个分区的伙伴系统
+static buddy_zone_t buddy_zone[zone_sum];
+
+// 将 order 阶的块 pfn 加入空闲链表头
+static inline void area_add(buddy_zone_t * bz, uint32_t pfn, uint32_t order);
+// 将 order 阶的块 pfn 从空闲链表中删除
+static inline void area_del(buddy_zone_t * bz, uint32_t pfn, uint32_t order);
+// 计算 pages 页需要的阶数
+static inline uint32_t pages_to_order(uint32_t pages);
+// 释放一个 order 阶的块，并与伙伴合并
+static void free_block(buddy_zone_t * bz, uint32_t pfn, uint32_t order);
+// 释放 [pfn, pfn + pages)，拆分为若干对齐的块
+static void free_range(buddy_zone_t * bz, uint32_t pfn, uint32_t pages);
+
+void area_add(buddy_zone_t * bz, uint32_t pfn, uint32_t order) {
+	buddy_free_area_t * area = &bz->free_area[order];
+	buddy_page[pfn].prev = BUDDY_PFN_NONE;
+	buddy_page[pfn].next = area->head;
+	if(area->head != BUDDY_PFN_NONE) {
+		buddy_page[area->head].prev = pfn;
+	}
+	area->head = pfn;
+	area->nr_free++;
+	buddy_page[pfn].order = order;
+	buddy_page[pfn].flag = BUDDY_FREE;
+	return;
+}
+
+void area_del(buddy_zone_t * bz, uint32_t pfn, uint32_t order) {
+	buddy_free_area_t * area = &bz->free_area[order];
+	uint32_t next = buddy_page[pfn].next;
+	uint32_t prev = buddy_page[pfn].prev;
+	if(prev != BUDDY_PFN_NONE) {
+		buddy_page[prev].next = next;
+	}
+	else {
+		area->head = next;
+	}
+	if(next != BUDDY_PFN_NONE) {
+		buddy_page[next].prev = prev;
+	}
+	area->nr_free--;
+	buddy_page[pfn].next = BUDDY_PFN_NONE;
+	buddy_page[pfn].prev = BUDDY_PFN_NONE;
+	return;
+}
+
+uint32_t pages_to_order(uint32_t pages) {
+	uint32_t order = 0;
+	while( (1UL << order) < pages) {
+		order++;
+	}
+	return order;
+}
+
+void free_block(buddy_zone_t * bz, uint32_t pfn, uint32_t order) {
+	// 每次合并都只需要检查伙伴的首页，O(1)
+	while(order < BUDDY_MAX_ORDER - 1) {
+		uint32_t buddy = pfn ^ (1UL << order);
+		// 伙伴必须在分区内，空闲且阶数相同
+		if(buddy < bz->pfn_start || buddy + (1UL << order) > bz->pfn_end) {
+			break;
+		}
+		if(buddy_page[buddy].flag != BUDDY_FREE || buddy_page[buddy].order != order) {
+			break;
+		}
+		area_del(bz, buddy, order);
+		pmm_stat_inc(bz - buddy_zone, PMM_STAT_MERGE);
+		// 被合并的伙伴不再是块首
+		buddy_page[buddy].flag = BUDDY_FREE_TAIL;
+		pfn &= ~(1UL << order);
+		order++;
+	}
+	area_add(bz, pfn, order);
+	return;
+}
+
+void free_range(buddy_zone_t * bz, uint32_t pfn, uint32_t pages) {
+	while(pages > 0) {
+		// 取 pfn 对齐允许且不超过剩余页数的最大阶
+		uint32_t order = 0;
+		while(order < BUDDY_MAX_ORDER - 1
+		    && (pfn & ( (1UL << (order + 1) ) - 1) ) == 0
+		    && (1UL << (order + 1) ) <= pages) {
+			order++;
+		}
+		free_block(bz, pfn, order);
+		pfn += 1UL << order;
+		pages -= 1UL << order;
+	}
+	return;
+}
+
+void init() {
+	bzero(buddy_zone, sizeof(buddy_zone) );
+	buddy_page = (buddy_page_t *)memblock_alloc(mem_page_count * sizeof(buddy_page_t), sizeof(buddy_page_t) );
+	assert(buddy_page != NULL, "Error at buddy.c: no memory for buddy_page\n");
+	return;
+}
+
+// 只初始化本分区范围内的页，各分区可以分别延迟初始化
+void zone_init(char zone) {
+	const ptr_t zone_addr[zone_sum + 1] = {
+		DMA_start_addr, NORMAL_start_addr, HIGHMEM_start_addr, PMM_MAX_SIZE
+	};
+	uint32_t z = (uint8_t)zone;
+	buddy_zone_t * bz = &buddy_zone[z];
+	bz->pfn_start = zone_addr[z] / PMM_PAGE_SIZE;
+	bz->pfn_end = zone_addr[z + 1] / PMM_PAGE_SIZE;
+	// 只管理实际存在的内存
+	if(bz->pfn_end > mem_page_count) {
+		bz->pfn_end = mem_page_count;
+	}
+	if(bz->pfn_start > bz->pfn_end) {
+		bz->pfn_start = bz->pfn_end;
+	}
+	bz->free_pages = 0;
+	for(uint32_t o = 0 ; o < BUDDY_MAX_ORDER ; o++) {
+		bz->free_area[o].head = BUDDY_PFN_NONE;
+		bz->free_area[o].nr_free = 0;
+	}
+	for(uint32_t i = bz->pfn_start ; i < bz->pfn_end ; i++) {
+		buddy_page[i].next = BUDDY_PFN_NONE;
+		buddy_page[i].prev = BUDDY_PFN_NONE;
+		buddy_page[i].order = 0;
+		buddy_page[i].flag = BUDDY_RESERVED;
+	}
+	// 找出连续的空闲页，整段交给伙伴系统
+	uint32_t pfn = bz->pfn_start;
+	while(pfn < bz->pfn_end) {
+		if(!page_is_free(&mem_page[pfn]) ) {
+			pfn++;
+			continue;
+		}
+		uint32_t run = pfn;
+		while(run < bz->pfn_end && page_is_free(&mem_page[run]) ) {
+			buddy_page[run].flag = BUDDY_FREE_TAIL;
+			run++;
+		}
+		free_range(bz, pfn, run - pfn);
+		bz->free_pages += run - pfn;
+		pfn = run;
+	}
+	return;
+}
+
+ptr_t alloc(uint32_t bytes, char zone) {
+	// 计算需要的页数
+	uint32_t pages = bytes / PMM_PAGE_SIZE;
+	// 不足一页的+1
+	if(bytes % PMM_PAGE_SIZE != 0) {
+		pages++;
+	}
+	uint32_t order = pages_to_order(pages);
+	buddy_zone_t * bz = &buddy_zone[(uint8_t)zone];
+	if(pages == 0 || order >= BUDDY_MAX_ORDER || bz->free_pages < pages) {
+		printk_err("Error at buddy.c: ptr_t alloc(uint32_t)\n");
+		return (ptr_t)NULL;
+	}
+	// 找到第一个非空的阶
+	uint32_t o = order;
+	while(o < BUDDY_MAX_ORDER && bz->free_area[o].head == BUDDY_PFN_NONE) {
+		o++;
+	}
+	if(o == BUDDY_MAX_ORDER) {
+		printk_err("Error at buddy.c: ptr_t alloc(uint32_t)\n");
+		return (ptr_t)NULL;
+	}
+	uint32_t pfn = bz->free_area[o].head;
+	area_del(bz, pfn, o);
+	// 逐级拆分，高半部分放回低一阶的空闲链表
+	while(o > order) {
+		o--;
+		area_add(bz, pfn + (1UL << o), o);
+		pmm_stat_inc(zone, PMM_STAT_SPLIT);
+	}
+	// 多余的尾部页仍是空闲块的中间页，直接还回去，分配多少页就占用多少页
+	for(uint32_t i = pfn ; i < pfn + pages ; i++) {
+		buddy_page[i].flag = BUDDY_USED;
+	}
+	if( (1UL << order) > pages) {
+		free_range(bz, pfn + pages, (1UL << order) - pages);
+	}
+	bz->free_pages -= pages;
+	return (ptr_t)pfn * PMM_PAGE_SIZE;
+}
+
+void free(ptr_t addr_start, uint32_t bytes, char zone) {
+	// 计算需要的页数
+	uint32_t pages = bytes / PMM_PAGE_SIZE;
+	// 不足一页的+1
+	if(bytes % PMM_PAGE_SIZE != 0) {
+		pages++;
+	}
+	buddy_zone_t * bz = &buddy_zone[(uint8_t)zone];
+	uint32_t pfn = addr_start / PMM_PAGE_SIZE;
+	if(pfn < bz->pfn_start || pfn + pages > bz->pfn_end) {
+		printk_err("Error at buddy.c: void free(ptr_t)\n");
+		return;
+	}
+	for(uint32_t i = pfn ; i < pfn + pages ; i++) {
+		if(buddy_page[i].flag != BUDDY_USED) {
+			printk_err("Error at buddy.c: void free(ptr_t)\n");
+			return;
+		}
+	}
+	// 块首在加入空闲链表时设置
+	for(uint32_t i = pfn ; i < pfn + pages ; i++) {
+		buddy_page[i].flag = BUDDY_FREE_TAIL;
+	}
+	free_range(bz, pfn, pages);
+	bz->free_pages += pages;
+	return;
+}
+
+// 块按自身大小对齐，申请不小于 align 的块后把多余的尾部还回去
+ptr_t alloc_align(uint32_t bytes, uint32_t align, char zone) {
+	uint32_t pages = (bytes + PMM_PAGE_SIZE - 1) / PMM_PAGE_SIZE;
+	uint32_t step = align / PMM_PAGE_SIZE;
+	if(step == 0 || (step & (step - 1) ) != 0) {
+		printk_err("Error at buddy.c: ptr_t alloc_align(uint32_t, uint32_t)\n");
+		return (ptr_t)NULL;
+	}
+	uint32_t need = (pages > step) ? pages : step;
+	ptr_t addr = alloc(need * PMM_PAGE_SIZE, zone);
+	if(addr != (ptr_t)NULL && need > pages) {
+		free(addr + pages * PMM_PAGE_SIZE, (need - pages) * PMM_PAGE_SIZE, zone);
+	}
+	return addr;
+}
+
+// 各阶空闲链表的长度就是分布
+void frag(char zone, pmm_frag_t * frag) {
+	buddy_zone_t * bz = &buddy_zone[(uint8_t)zone];
+	for(uint32_t o = 0 ; o < BUDDY_MAX_ORDER ; o++) {
+		frag->blocks[pmm_frag_order(1UL << o)] += bz->free_area[o].nr_free;
+		frag->pages[pmm_frag_order(1UL << o)] += bz->free_area[o].nr_free << o;
+	}
+	return;
+}
+
+uint32_t free_pages_count(char zone) {
+	return buddy_zone[(uint8_t)zone].free_pages;
+}
+
+#ifdef __cplusplus
+}
+#endif
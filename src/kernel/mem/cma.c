@@ -0,0 +1,210 @@
+
+// This file is a part of MRNIU/SimpleKernel (https://github.com/MRNIU/SimpleKernel).
+//
+// cma.c for MRNIU/SimpleKernel.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stdint.h"
+#include "stdio.h"
+#include "string.h"
+#include "sync.hpp"
+#include "mem/vmm.h"
+#include "mem/cma.h"
+
+#define CMA_FREE        (0x00)
+// 借给可移动的申请
+#define CMA_MOVABLE     (0x01)
+// 被 cma_alloc() 申请
+#define CMA_USED        (0x02)
+
+// 区域起始物理地址，预留失败时为 NULL
+static ptr_t cma_base = (ptr_t)NULL;
+// 每一页的信息
+static cma_page_t cma_page[CMA_PAGES];
+// 空闲页数
+static uint32_t cma_free_count = 0;
+// 下次借出时开始查找的位置
+static uint32_t cma_next = 0;
+
+// 借出一页，没有空闲页时返回 NULL
+static ptr_t cma_borrow(cma_migrate_t migrate, void * data);
+// 将借出的第 idx 页迁移出去，调用者需关中断
+static bool cma_migrate_page(uint32_t idx);
+
+void cma_init(void) {
+	cma_base = pmm_alloc(CMA_SIZE, DMA);
+	if(cma_base == (ptr_t)NULL) {
+		printk_err("Error at cma.c: void cma_init(void)\n");
+		return;
+	}
+	bzero(cma_page, sizeof(cma_page) );
+	cma_free_count = CMA_PAGES;
+	cma_next = 0;
+	printk_info("cma_init: 0x%08X, %d pages\n", cma_base, CMA_PAGES);
+	return;
+}
+
+bool cma_contains(ptr_t addr) {
+	return cma_base != (ptr_t)NULL && addr >= cma_base && addr < cma_base + CMA_SIZE;
+}
+
+void cma_release(ptr_t addr) {
+	bool intr_flag = false;
+	local_intr_store(intr_flag);
+	{
+		uint32_t idx = (addr - cma_base) / PMM_PAGE_SIZE;
+		if(cma_page[idx].state == CMA_MOVABLE) {
+			cma_page[idx].state = CMA_FREE;
+			cma_page[idx].migrate = NULL;
+			cma_page[idx].data = NULL;
+			cma_free_count++;
+			page_set_ref(addr_page(addr), 0);
+		}
+		else {
+			printk_err("Error at cma.c: void cma_release(ptr_t)\n");
+		}
+	}
+	local_intr_restore(intr_flag);
+	return;
+}
+
+uint32_t cma_free_pages_count(void) {
+	return cma_free_count;
+}
+
+ptr_t cma_borrow(cma_migrate_t migrate, void * data) {
+	ptr_t page = (ptr_t)NULL;
+	bool intr_flag = false;
+	local_intr_store(intr_flag);
+	{
+		for(uint32_t i = 0 ; i < CMA_PAGES && cma_free_count > 0 ; i++) {
+			uint32_t idx = (cma_next + i) % CMA_PAGES;
+			if(cma_page[idx].state == CMA_FREE) {
+				cma_page[idx].state = CMA_MOVABLE;
+				cma_page[idx].migrate = migrate;
+				cma_page[idx].data = data;
+				cma_free_count--;
+				cma_next = (idx + 1) % CMA_PAGES;
+				page = cma_base + idx * PMM_PAGE_SIZE;
+				page_set_ref(addr_page(page), 1);
+				break;
+			}
+		}
+	}
+	local_intr_restore(intr_flag);
+	return page;
+}
+
+// 先从普通分区取，不够时借用，都没有再回收重试
+ptr_t cma_alloc_movable(uint32_t flags, cma_migrate_t migrate, void * data) {
+	ptr_t page = pmm_alloc_flags(PMM_PAGE_SIZE, flags | PMM_NORETRY);
+	if(page != (ptr_t)NULL) {
+		return page;
+	}
+	if(migrate != NULL) {
+		page = cma_borrow(migrate, data);
+		if(page != (ptr_t)NULL) {
+			if(flags & PMM_ZERO) {
+				bzero( (void *)VMM_PA_LA(page), PMM_PAGE_SIZE);
+			}
+			return page;
+		}
+	}
+	return pmm_alloc_flags(PMM_PAGE_SIZE, flags);
+}
+
+bool cma_migrate_page(uint32_t idx) {
+	ptr_t old_pa = cma_base + idx * PMM_PAGE_SIZE;
+	// 新的页不能再来自区域
+	ptr_t new_pa = pmm_alloc_flags(PMM_PAGE_SIZE, PMM_KERNEL);
+	if(new_pa == (ptr_t)NULL) {
+		return false;
+	}
+	// 物理页通过线性映射区访问
+	memcpy( (void *)VMM_PA_LA(new_pa), (void *)VMM_PA_LA(old_pa), PMM_PAGE_SIZE);
+	if(!cma_page[idx].migrate(old_pa, new_pa, cma_page[idx].data) ) {
+		pmm_free(new_pa, PMM_PAGE_SIZE);
+		return false;
+	}
+	page_set_ref(addr_page(old_pa), 0);
+	cma_page[idx].state = CMA_FREE;
+	cma_page[idx].migrate = NULL;
+	cma_page[idx].data = NULL;
+	cma_free_count++;
+	return true;
+}
+
+// 首次适应，跳过被 cma_alloc() 占用的页，借出的页迁移出去
+ptr_t cma_alloc(uint32_t bytes) {
+	ptr_t addr = (ptr_t)NULL;
+	uint32_t pages = (bytes + PMM_PAGE_SIZE - 1) / PMM_PAGE_SIZE;
+	if(cma_base == (ptr_t)NULL || pages == 0 || pages > CMA_PAGES) {
+		printk_err("Error at cma.c: ptr_t cma_alloc(uint32_t)\n");
+		return (ptr_t)NULL;
+	}
+	bool intr_flag = false;
+	local_intr_store(intr_flag);
+	{
+		uint32_t start = 0;
+		while(addr == (ptr_t)NULL && start + pages <= CMA_PAGES) {
+			uint32_t end = start;
+			while(end < start + pages && cma_page[end].state != CMA_USED) {
+				end++;
+			}
+			if(end < start + pages) {
+				start = end + 1;
+				continue;
+			}
+			for(end = start ; end < start + pages ; end++) {
+				if(cma_page[end].state == CMA_MOVABLE && !cma_migrate_page(end) ) {
+					break;
+				}
+			}
+			// 迁移失败的页留在原处，从它之后继续找
+			if(end < start + pages) {
+				start = end + 1;
+				continue;
+			}
+			for(end = start ; end < start + pages ; end++) {
+				cma_page[end].state = CMA_USED;
+				page_set_ref(&mem_page[cma_base / PMM_PAGE_SIZE + end], 1);
+			}
+			cma_free_count -= pages;
+			addr = cma_base + start * PMM_PAGE_SIZE;
+		}
+	}
+	local_intr_restore(intr_flag);
+	if(addr == (ptr_t)NULL) {
+		printk_err("Error at cma.c: ptr_t cma_alloc(uint32_t)\n");
+	}
+	return addr;
+}
+
+void cma_free(ptr_t addr, uint32_t bytes) {
+	uint32_t pages = (bytes + PMM_PAGE_SIZE - 1) / PMM_PAGE_SIZE;
+	if(!cma_contains(addr) || !cma_contains(addr + pages * PMM_PAGE_SIZE - 1) ) {
+		printk_err("Error at cma.c: void cma_free(ptr_t, uint32_t)\n");
+		return;
+	}
+	bool intr_flag = false;
+	local_intr_store(intr_flag);
+	{
+		uint32_t idx = (addr - cma_base) / PMM_PAGE_SIZE;
+		for(uint32_t i = idx ; i < idx + pages ; i++) {
+			if(cma_page[i].state == CMA_USED) {
+				cma_page[i].state = CMA_FREE;
+				page_set_ref(addr_page(cma_base + i * PMM_PAGE_SIZE), 0);
+				cma_free_count++;
+			}
+		}
+	}
+	local_intr_restore(intr_flag);
+	return;
+}
+
+#ifdef __cplusplus
+}
+#endif
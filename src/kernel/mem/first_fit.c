@@ -12,21 +12,29 @@ extern "C" {
 #include "string.h"
 #include "assert.h"
 #include "mem/firstfit.h"
+#include "mem/memblock.h"
 
 #define FF_USED         (0x00)
 #define FF_UNUSED       (0x01)
 
 static void init();
-static ptr_t alloc(uint32_t bytes,char zone);
-static void free(ptr_t addr_start, uint32_t bytes,char zone);
+static void zone_init(char zone);
+static ptr_t alloc(uint32_t bytes, char zone);
+static void free(ptr_t addr_start, uint32_t bytes, char zone);
 static uint32_t free_pages_count(char zone);
+static ptr_t alloc_align(uint32_t bytes, uint32_t align, char zone);
+static void frag(char zone, pmm_frag_t * frag);
 
 pmm_manage_t firstfit_manage = {
 	"Fitst Fit",
 	&init,
+	&zone_init,
 	&alloc,
 	&free,
-	&free_pages_count
+	&free_pages_count,
+	NULL,
+	&alloc_align,
+	&frag
 };
 
 
@@ -106,351 +114,424 @@ chunk_info_t * list_chunk_info(list_entry_t * list) {
 
 /**********************************/
 //分区管理，定义3个管理器，均使用first-fit算法
-// First Fit 算法需要的信息
-//static firstfit_manage_t ff_manage;
-//static firstfit_manage_t ff_manage_dma;
-//static firstfit_manage_t ff_manage_normal;
-//static firstfit_manage_t ff_manage_highmem;
-
-// 物理页信息保存地址
-static list_entry_t * pmm_info = NULL;
-/*****************************************/
-//管理器信息也需要物理页进行存储，所以这些页面也需要被设置为已引用
-/*****************************************/
-void init() {
-	// 位于内核结束后，大小为 (PMM_MAX_SIZE / PMM_PAGE_SIZE)*sizeof(list_entry_t)
-	// 后面的操作是进行页对齐
-	/****************************/
-	//每个分区初始化一个管理器
-
-/*
-	normal_pmm_info=(list_entry_t *)((ptr_t)(0x1000000));
-	uint32_t normal_pmm_info_size = mem_zone[NORMAL].free_pages * sizeof(list_entry_t);
-	bzero(normal_pmm_info,normal_pmm_info_size);
-	highmem_pmm_info=(list_entry_t *)((ptr_t)(0x6e00000));
-	uint32_t highmem_pmm_info_size = mem_zone[HIGHMEM].free_pages * sizeof(list_entry_t);
-	bzero(highmem_pmm_info,highmem_pmm_info_size);
-*/	
-	printk_info("%d\n",mem_zone[DMA].all_pages);
-	//将DMA区域的空闲链表放在地址为0的位置,NORMAL区域的空闲链表放在16MB处，HIGHMEM放在110MB处
-	list_entry_t *dma_pmm_info=(list_entry_t *)((ptr_t)(DMA_start_addr));
-	list_entry_t *normal_pmm_info=(list_entry_t *)((ptr_t)(NORMAL_start_addr));
-	list_entry_t *highmem_pmm_info=(list_entry_t *)((ptr_t)(HIGHMEM_start_addr));
-	//最差情况，一块只有一个页，所以预先留好空间存储这些块信息
-	uint32_t dma_pmm_info_size = mem_zone[DMA].all_pages * sizeof(list_entry_t);
-	uint32_t normal_pmm_info_size = mem_zone[NORMAL].all_pages * sizeof(list_entry_t);
-	uint32_t highmem_pmm_info_size = mem_zone[HIGHMEM].all_pages * sizeof(list_entry_t);
-	//printk_info("dma_need_page:%d\n",normal_pmm_info_size/PMM_PAGE_SIZE);
-	//printk_info("dma_need_page:%d\n",normal_pmm_info_size);
-	//printk_info("addr:0x%08X\n",normal_pmm_info);
-	//printk_info("dma_need_page:%d\n",dma_pmm_info_size/PMM_PAGE_SIZE);
-	//printk_info("dma_need_page:%d\n",dma_pmm_info_size);
-	//printk_info("addr:0x%08X\n",dma_pmm_info);
-	//printk_info("successful1!\n");	
-	//printk_info("successful2!\n");
-	bzero(dma_pmm_info,dma_pmm_info_size);
-	//printk_info("successful2!\n");
-	bzero(normal_pmm_info,normal_pmm_info_size);
-	//printk_info("successful3!\n");
-	bzero(highmem_pmm_info,highmem_pmm_info_size);
-	//printk_info("successful4!\n");
-	//list_entry_t *dma_pmm_info_head;
-	//mem_page数组的指示变量
-	uint32_t k=0;
-	//根据dma区域的总页数和mem_page数组映射关系确定 某个物理页是否空闲
-	for(uint32_t z=0;z<zone_sum;z++)
-	{
-		//初始化DMA区域的空闲链表，当有连续的空闲页时，进行合并
-		uint32_t i=0;
-		//记录节点数
-		uint32_t num=0;
-		//count作为计数器，记录连续空闲页的个数
-		int count=0;
-		//flag1、flag2作为标志变量，
-		int flag1=0,flag2=0;
-		ptr_t addr=0;
-		//first=true代表该节点是第一个节点，否则不是
-		bool first=true;
-		//中转节点
-		list_entry_t *before;
-		ptr_t info_addr;
-		//头节点
-		list_entry_t *pmm_info_head;
-		//中间节点
-		list_entry_t *pmm_info_node;
-		if(z==DMA)
-			info_addr=(ptr_t)DMA_start_addr;
-		else if(z==NORMAL)
-			info_addr=(ptr_t)NORMAL_start_addr;
-		else if(z==HIGHMEM)
-			info_addr=(ptr_t)HIGHMEM_start_addr;
-		//printk_info("successful!\n");
-		/*****************************/
-		/*        
-				需要解决两种情况      
-				1、一个可用内存页接一个不可用内存页，此时需创建节点，通过标志变量flag2和计数器count解决
-				2、可用内存页需进行合并，且地址为第一个可用内存页的地址，通过标志变量flag1解决
-		*/
-		/*****************************/
-		while(i<mem_zone[z].all_pages)
-		{
-			//如果该页可用且空闲
-			if(!mem_page[k].ref)
-			{
-				//记录该页前是否有空闲页，若有则地址为前面空闲页地址，然后计数加1
-				if(!flag1)
-					addr=mem_page[k].start;
-				count++;
-				flag1=1;
-				flag2=1;
-				//到达分区最后一页
-				if(i==mem_zone[z].all_pages-1)
-					flag2=0;
-			}
-			else
-			{
-				flag1=0;
-				flag2=0;
-			}
-			i++;
-			k++;	
-			if(!flag2&&count)
-			{
-				if(first)
-				{
-					pmm_info_head=(list_entry_t *)(info_addr);
-					//uint32_t new_dma_nfo_size =  sizeof(list_entry_t);
-					bzero(pmm_info_head, sizeof(list_entry_t));
-					pmm_info_head->chunk_info.addr=addr;
-					pmm_info_head->chunk_info.npages=count;
-					pmm_info_head->chunk_info.ref=0;
-					pmm_info_head->chunk_info.flag=FF_UNUSED;
-					info_addr+=sizeof(list_entry_t);
-					first=false;
-					list_init_head(pmm_info_head);
-					before=pmm_info_head;
-					num++;
-				}
-				else
-				{
-					pmm_info_node=(list_entry_t *)(info_addr);
-					//uint32_t new_dma_info_size =  sizeof(list_entry_t);
-					bzero(pmm_info_node, sizeof(list_entry_t));
-					pmm_info_node->chunk_info.addr=addr;
-					pmm_info_node->chunk_info.npages=count;
-					pmm_info_node->chunk_info.ref=0;
-					pmm_info_node->chunk_info.flag=FF_UNUSED;
-					info_addr+=sizeof(list_entry_t);
-					list_add_after(before,pmm_info_node);
-					before=pmm_info_node;
-					num++;
-				}
-				count=0;
-			}
-		}
-		if(z==DMA)
-		{
-			ff_manage_dma.phy_page_count=mem_zone[z].all_pages;
-			ff_manage_dma.phy_page_now_count=mem_zone[z].free_pages;
-			ff_manage_dma.node_num=num;
-			ff_manage_dma.free_list=pmm_info_head;//(list_entry_t *)(ptr_t)DMA_start_addr;
+static firstfit_manage_t * const ff_manages[zone_sum] = {
+	&ff_manage_dma, &ff_manage_normal, &ff_manage_highmem
+};
+// 各分区的起止地址
+static const ptr_t ff_zone_addr[zone_sum + 1] = {
+	DMA_start_addr, NORMAL_start_addr, HIGHMEM_start_addr, PMM_MAX_SIZE
+};
+// 各分区的节点存储区，启动时从 memblock 申请
+static list_entry_t * ff_node_base[zone_sum];
+static uint32_t ff_node_max[zone_sum];
+
+// 根据分区找到对应的管理器
+static inline firstfit_manage_t * zone_manage(char zone);
+// 申请/释放一个节点
+static inline list_entry_t * node_alloc(firstfit_manage_t * ff_manage);
+static inline void node_free(firstfit_manage_t * ff_manage, list_entry_t * entry);
+// 索引的比较方法
+static int addr_cmp(avl_node_t * node1, avl_node_t * node2);
+static int size_cmp(avl_node_t * node1, avl_node_t * node2);
+// 在地址索引中查找起始地址为 addr 的块
+static list_entry_t * addr_find(firstfit_manage_t * ff_manage, ptr_t addr);
+// 在大小索引中查找不小于 pages 的最小空闲块
+static list_entry_t * size_find(firstfit_manage_t * ff_manage, uint32_t pages);
+// entry 后是否紧跟着 next
+static inline bool chunk_adjacent(list_entry_t * entry, list_entry_t * next);
+// 页数对应的级别，向下/向上取整
+static inline uint32_t bucket_floor(uint32_t pages);
+static inline uint32_t bucket_ceil(uint32_t pages);
+// 空闲块加入/移出大小索引和分级链表
+static void free_index_add(firstfit_manage_t * ff_manage, list_entry_t * entry);
+static void free_index_del(firstfit_manage_t * ff_manage, list_entry_t * entry);
+// 为 pages 页找到一个空闲块
+static list_entry_t * free_index_find(firstfit_manage_t * ff_manage, uint32_t pages, char zone);
+
+firstfit_manage_t * zone_manage(char zone) {
+	if(zone < 0 || zone >= zone_sum) {
+		return (firstfit_manage_t *)NULL;
+	}
+	return ff_manages[(uint8_t)zone];
+}
+
+list_entry_t * node_alloc(firstfit_manage_t * ff_manage) {
+	list_entry_t * entry = (list_entry_t *)NULL;
+	if(ff_manage->node_free != NULL) {
+		entry = ff_manage->node_free;
+		ff_manage->node_free = entry->next;
+	}
+	else if(ff_manage->node_top < ff_manage->node_max) {
+		entry = &ff_manage->node_base[ff_manage->node_top++];
+	}
+	else {
+		return (list_entry_t *)NULL;
+	}
+	bzero(entry, sizeof(list_entry_t) );
+	ff_manage->node_num++;
+	return entry;
+}
+
+void node_free(firstfit_manage_t * ff_manage, list_entry_t * entry) {
+	entry->next = ff_manage->node_free;
+	ff_manage->node_free = entry;
+	ff_manage->node_num--;
+	return;
+}
+
+int addr_cmp(avl_node_t * node1, avl_node_t * node2) {
+	ptr_t addr1 = avl_entry(node1, list_entry_t, addr_node)->chunk_info.addr;
+	ptr_t addr2 = avl_entry(node2, list_entry_t, addr_node)->chunk_info.addr;
+	return (addr1 < addr2) ? -1 : (addr1 > addr2);
+}
+
+// 先比较大小，相同大小时地址小的在前
+int size_cmp(avl_node_t * node1, avl_node_t * node2) {
+	chunk_info_t * info1 = &avl_entry(node1, list_entry_t, size_node)->chunk_info;
+	chunk_info_t * info2 = &avl_entry(node2, list_entry_t, size_node)->chunk_info;
+	if(info1->npages != info2->npages) {
+		return (info1->npages < info2->npages) ? -1 : 1;
+	}
+	return (info1->addr < info2->addr) ? -1 : (info1->addr > info2->addr);
+}
+
+list_entry_t * addr_find(firstfit_manage_t * ff_manage, ptr_t addr) {
+	avl_node_t * node = ff_manage->addr_tree.node;
+	while(node != NULL) {
+		list_entry_t * entry = avl_entry(node, list_entry_t, addr_node);
+		if(addr == list_chunk_info(entry)->addr) {
+			return entry;
 		}
-		else if(z==NORMAL)
-		{
-			ff_manage_normal.phy_page_count=mem_zone[z].all_pages;
-			ff_manage_normal.phy_page_now_count=mem_zone[z].free_pages;
-			ff_manage_normal.node_num=num;
-			ff_manage_normal.free_list=pmm_info_head;//(list_entry_t *)(ptr_t)NORMAL_start_addr;
+		node = (addr < list_chunk_info(entry)->addr) ? node->left : node->right;
+	}
+	return (list_entry_t *)NULL;
+}
+
+list_entry_t * size_find(firstfit_manage_t * ff_manage, uint32_t pages) {
+	list_entry_t * best = (list_entry_t *)NULL;
+	avl_node_t * node = ff_manage->size_tree.node;
+	while(node != NULL) {
+		list_entry_t * entry = avl_entry(node, list_entry_t, size_node);
+		if(list_chunk_info(entry)->npages >= pages) {
+			best = entry;
+			node = node->left;
 		}
-		else if(z==HIGHMEM)
-		{
-			ff_manage_highmem.phy_page_count=mem_zone[z].all_pages;
-			ff_manage_highmem.phy_page_now_count=mem_zone[z].free_pages;
-			ff_manage_highmem.node_num=num;
-			ff_manage_highmem.free_list=pmm_info_head;//(list_entry_t *)(ptr_t)HIGHMEM_start_addr;		
+		else {
+			node = node->right;
 		}
+	}
+	return best;
+}
+
+bool chunk_adjacent(list_entry_t * entry, list_entry_t * next) {
+	return list_chunk_info(entry)->addr + list_chunk_info(entry)->npages * PMM_PAGE_SIZE
+	       == list_chunk_info(next)->addr;
+}
+
+uint32_t bucket_floor(uint32_t pages) {
+	return 31 - __builtin_clz(pages);
+}
+
+uint32_t bucket_ceil(uint32_t pages) {
+	return (pages == 1) ? 0 : 32 - __builtin_clz(pages - 1);
+}
 
+void free_index_add(firstfit_manage_t * ff_manage, list_entry_t * entry) {
+	uint32_t idx = bucket_floor(list_chunk_info(entry)->npages);
+	avl_insert(&ff_manage->size_tree, &entry->size_node, size_cmp);
+	// 加到该级链表头
+	entry->bucket_prev = (list_entry_t *)NULL;
+	entry->bucket_next = ff_manage->bucket[idx];
+	if(entry->bucket_next != NULL) {
+		entry->bucket_next->bucket_prev = entry;
 	}
-	/*
-	//打印DMA区域链表
-	list_entry_t *head=ff_manage_dma.free_list;
-	//打印头节点
-	printk_test("DMA Physical Addr: 0x%08X\n",head->chunk_info.addr);
-	printk_test("DMA Physical pages: %d\n",head->chunk_info.npages);
-	printk_test("DMA Physical ref: %d\n",head->chunk_info.ref);
-	printk_test("DMA Physical flag: %d\n",head->chunk_info.flag);
-	list_entry_t *p=head->next;
-	while(p!=head)
-	{
-		printk_test("DMA Physical Addr: 0x%08X\n",p->chunk_info.addr);
-		printk_test("DMA Physical pages: %d\n",p->chunk_info.npages);
-		printk_test("DMA Physical ref: %d\n",p->chunk_info.ref);
-		printk_test("DMA Physical flag: %d\n",p->chunk_info.flag);
-		p=p->next;
+	ff_manage->bucket[idx] = entry;
+	ff_manage->bucket_mask |= (1UL << idx);
+	return;
+}
+
+void free_index_del(firstfit_manage_t * ff_manage, list_entry_t * entry) {
+	uint32_t idx = bucket_floor(list_chunk_info(entry)->npages);
+	avl_remove(&ff_manage->size_tree, &entry->size_node);
+	if(entry->bucket_prev != NULL) {
+		entry->bucket_prev->bucket_next = entry->bucket_next;
 	}
-	
-	//打印NORMAL区域链表
-	head=ff_manage_normal.free_list;
-	//打印头节点
-	printk_test("NORMAL Physical Addr: 0x%08X\n",head->chunk_info.addr);
-	printk_test("NORMAL Physical pages: %d\n",head->chunk_info.npages);
-	printk_test("NORMAL Physical ref: %d\n",head->chunk_info.ref);
-	printk_test("NORMAL Physical flag: %d\n",head->chunk_info.flag);
-	p=head->next;
-	while(p!=head)
-	{
-		printk_test("NORMAL Physical Addr: 0x%08X\n",p->chunk_info.addr);
-		printk_test("NORMAL Physical pages: %d\n",p->chunk_info.npages);
-		printk_test("NORMAL Physical ref: %d\n",p->chunk_info.ref);
-		printk_test("NORMAL Physical flag: %d\n",p->chunk_info.flag);
-		p=p->next;
+	else {
+		ff_manage->bucket[idx] = entry->bucket_next;
 	}
-	//打印HIGHMEM区域链表
-	head=ff_manage_highmem.free_list;
-	//打印头节点
-	printk_test("HIGHMEM Physical Addr: 0x%08X\n",head->chunk_info.addr);
-	printk_test("HIGHMEM Physical pages: %d\n",head->chunk_info.npages);
-	printk_test("HIGHMEM Physical ref: %d\n",head->chunk_info.ref);
-	printk_test("HIGHMEM Physical flag: %d\n",head->chunk_info.flag);
-	p=head->next;
-	while(p!=head)
-	{
-		printk_test("HIGHMEM Physical Addr: 0x%08X\n",p->chunk_info.addr);
-		printk_test("HIGHMEM Physical pages: %d\n",p->chunk_info.npages);
-		printk_test("HIGHMEM Physical ref: %d\n",p->chunk_info.ref);
-		printk_test("HIGHMEM Physical flag: %d\n",p->chunk_info.flag);
-		p=p->next;
+	if(entry->bucket_next != NULL) {
+		entry->bucket_next->bucket_prev = entry->bucket_prev;
+	}
+	if(ff_manage->bucket[idx] == NULL) {
+		ff_manage->bucket_mask &= ~(1UL << idx);
 	}
-	*/
-	printk_info("successful-final!\n");
-	/****************************/
-
-/*	pmm_info = (list_entry_t *)( ( (ptr_t)(&kernel_end + PMM_PAGE_SIZE) & PMM_PAGE_MASK) );
-	uint32_t pmm_info_size = (PMM_MAX_SIZE / PMM_PAGE_SIZE) * sizeof(list_entry_t);
-	bzero(pmm_info, pmm_info_size);
-
-	// 越过内核使用的内存
-	pmm_info->chunk_info.addr = page_start + KERNEL_SIZE;
-	pmm_info->chunk_info.npages = page_count - PMM_PAGES_KERNEL;
-	pmm_info->chunk_info.ref = 0;
-	pmm_info->chunk_info.flag = FF_UNUSED;
-
-	ff_manage.phy_page_count = page_count;
-	ff_manage.phy_page_now_count = page_count - PMM_PAGES_KERNEL;
-	// 0x100000
-	ff_manage.pmm_addr_start = page_start + KERNEL_SIZE;
-	// 0x1FFF0000
-	ff_manage.pmm_addr_end = page_start + page_count * PMM_PAGE_SIZE;
-	ff_manage.free_list = pmm_info;
-	list_init_head(ff_manage.free_list);
-*/
 	return;
 }
 
-//根据线性地址判断属于那个管理区，然后使用对应的物理分区管理器进行分配。
-ptr_t alloc(uint32_t bytes,char zone) {
-	// 计算需要的页数
-	size_t pages = bytes / PMM_PAGE_SIZE;
-	// 不足一页的+1
-	if(bytes % PMM_PAGE_SIZE != 0) {
-		pages++;
+list_entry_t * free_index_find(firstfit_manage_t * ff_manage, uint32_t pages, char zone) {
+	// DMA 区域较小，且需要为设备保留大块连续内存，使用最佳适应
+	if(zone == DMA) {
+		return size_find(ff_manage, pages);
+	}
+	// 不小于 2^ceil(log2(pages)) 的级别中任何一块都满足要求，
+	// 取最低的非空级别，bsf 一次即可找到，这样小的申请优先使用小的空闲块
+	uint32_t idx = bucket_ceil(pages);
+	uint32_t mask = (idx < FF_BUCKET_MAX) ? ff_manage->bucket_mask & ~( (1UL << idx) - 1) : 0;
+	if(mask != 0) {
+		return ff_manage->bucket[__builtin_ctz(mask)];
 	}
+	// 只剩 pages 所在级别可能满足，在大小索引中查找
+	return size_find(ff_manage, pages);
+}
 
-	// 首先根据分区找到对应的管理器，然后找到地址对应的管理节点
-	firstfit_manage_t ff_manage;
-	if(zone==DMA)
-		ff_manage = ff_manage_dma;
-	else if(zone==NORMAL)
-		ff_manage = ff_manage_normal;
-	else if(zone==HIGHMEM)
-		ff_manage = ff_manage_highmem;
-	list_entry_t *entry=ff_manage.free_list;
-	//printk_info("successful-1!\n");
-	while(entry >=0) {
-		//printk_info("successful-2!\n");
-		// 查找符合长度且未使用的内存
-		if( (list_chunk_info(entry)->npages >= pages) && (list_chunk_info(entry)->flag == FF_UNUSED) ) {
-			//printk_info("successful-2!\n");
-			// 如果剩余大小足够
-			if(list_chunk_info(entry)->npages - pages > 1) {
-				// 添加新的链表项
-				list_entry_t * tmp = (list_entry_t *)(entry + ff_manage.node_num*sizeof(list_entry_t) );
-				list_chunk_info(tmp)->addr = entry->chunk_info.addr + pages * PMM_PAGE_SIZE;
-				list_chunk_info(tmp)->npages =  entry->chunk_info.npages - pages;
-				list_chunk_info(tmp)->ref = 0;
-				list_chunk_info(tmp)->flag = FF_UNUSED;
-				list_add_after(entry, tmp);
-			}
-			//printk_info("successful-3!\n");
-			// 不够的话直接分配
-			list_chunk_info(entry)->npages = pages;
-			list_chunk_info(entry)->ref = 1;
-			list_chunk_info(entry)->flag = FF_USED;
-			ff_manage.phy_page_now_count -= pages;
-			return list_chunk_info(entry)->addr;
+// 延迟初始化的分区也在这里申请节点存储区，之后 memblock 不再可用
+void init() {
+	for(uint32_t z = 0 ; z < zone_sum ; z++) {
+		bzero(ff_manages[z], sizeof(firstfit_manage_t) );
+		// 最差情况，一块只有一个页，只按实际存在的内存计算
+		uint32_t pfn_start = ff_zone_addr[z] / PMM_PAGE_SIZE;
+		uint32_t pfn_end = ff_zone_addr[z + 1] / PMM_PAGE_SIZE;
+		if(pfn_end > mem_page_count) {
+			pfn_end = mem_page_count;
 		}
-		// 没找到的话就查找下一个
-		else if(list_next(entry) != ff_manage.free_list) {
-			entry = list_next(entry);
+		ff_node_max[z] = (pfn_end > pfn_start) ? pfn_end - pfn_start : 0;
+		ff_node_base[z] = (list_entry_t *)memblock_alloc(ff_node_max[z] * sizeof(list_entry_t), sizeof(list_entry_t) );
+		if(ff_node_base[z] == NULL) {
+			ff_node_max[z] = 0;
 		}
-		else {
-			printk_err("Error at firstfit.c: ptr_t alloc(uint32_t)\n");
+	}
+	printk_info("successful-final!\n");
+	return;
+}
+
+// 各分区互不相关，可以在首次使用时再初始化
+// 节点存储区与 0 号页已经在 memblock 中保留，物理页数组中不是空闲页
+void zone_init(char zone) {
+	uint32_t z = (uint8_t)zone;
+	firstfit_manage_t * ff_manage = ff_manages[z];
+	// 该分区第一页在 mem_page 中的下标
+	uint32_t first = ff_zone_addr[z] / PMM_PAGE_SIZE;
+	bzero(ff_manage, sizeof(firstfit_manage_t) );
+	ff_manage->pmm_addr_start = ff_zone_addr[z];
+	ff_manage->pmm_addr_end = ff_zone_addr[z] + mem_zone[z].all_pages * PMM_PAGE_SIZE;
+	ff_manage->phy_page_count = mem_zone[z].all_pages;
+	ff_manage->node_base = ff_node_base[z];
+	ff_manage->node_max = ff_node_max[z];
+	avl_init_root(&ff_manage->addr_tree);
+	avl_init_root(&ff_manage->size_tree);
+	/*****************************/
+	// 将连续的空闲页合并为一个节点，按地址顺序加入链表
+	/*****************************/
+	uint32_t k = first;
+	while(k < first + mem_zone[z].all_pages) {
+		if(!page_is_free(&mem_page[k]) ) {
+			k++;
+			continue;
+		}
+		uint32_t count = 0;
+		while(k + count < first + mem_zone[z].all_pages && page_is_free(&mem_page[k + count]) ) {
+			count++;
+		}
+		list_entry_t * entry = node_alloc(ff_manage);
+		if(entry == NULL) {
+			printk_err("Error at firstfit.c: void zone_init(char)\n");
 			break;
 		}
+		list_chunk_info(entry)->addr = page_addr(&mem_page[k]);
+		list_chunk_info(entry)->npages = count;
+		list_chunk_info(entry)->ref = 0;
+		list_chunk_info(entry)->flag = FF_UNUSED;
+		if(ff_manage->free_list == NULL) {
+			list_init_head(entry);
+			ff_manage->free_list = entry;
+		}
+		else {
+			list_add_before(ff_manage->free_list, entry);
+		}
+		avl_insert(&ff_manage->addr_tree, &entry->addr_node, addr_cmp);
+		free_index_add(ff_manage, entry);
+		ff_manage->phy_page_now_count += count;
+		k += count;
 	}
-	printk_err("Error at firstfit.c: ptr_t alloc(uint32_t)\n");
-	return (ptr_t)NULL;
+	return;
 }
 
-void free(ptr_t addr_start, uint32_t bytes,char zone) {
+//根据分区找到对应的管理器，在分级链表中找到合适的空闲块进行分配。
+ptr_t alloc(uint32_t bytes, char zone) {
 	// 计算需要的页数
 	size_t pages = bytes / PMM_PAGE_SIZE;
 	// 不足一页的+1
 	if(bytes % PMM_PAGE_SIZE != 0) {
 		pages++;
 	}
-	// 首先根据分区找到对应的管理器，然后找到地址对应的管理节点
-	firstfit_manage_t *ff_manage;
-	if(zone==DMA)
-		ff_manage = &ff_manage_dma;
-	else if(zone==NORMAL)
-		ff_manage = &ff_manage_normal;
-	else if(zone==HIGHMEM)
-		ff_manage = &ff_manage_highmem;
-	list_entry_t * entry = ff_manage->free_list;
-	while( ( (entry = list_next(entry) ) != ff_manage->free_list) && (list_chunk_info(entry)->addr != addr_start) );
+	firstfit_manage_t * ff_manage = zone_manage(zone);
+	if(ff_manage == NULL || pages == 0) {
+		printk_err("Error at firstfit.c: ptr_t alloc(uint32_t)\n");
+		return (ptr_t)NULL;
+	}
+	// 查找符合长度的空闲块
+	list_entry_t * entry = free_index_find(ff_manage, pages, zone);
+	if(entry == NULL) {
+		printk_err("Error at firstfit.c: ptr_t alloc(uint32_t)\n");
+		return (ptr_t)NULL;
+	}
+	free_index_del(ff_manage, entry);
+	// 如果剩余大小足够
+	if(list_chunk_info(entry)->npages > pages) {
+		// 添加新的链表项
+		list_entry_t * tmp = node_alloc(ff_manage);
+		if(tmp == NULL) {
+			free_index_add(ff_manage, entry);
+			printk_err("Error at firstfit.c: ptr_t alloc(uint32_t)\n");
+			return (ptr_t)NULL;
+		}
+		list_chunk_info(tmp)->addr = list_chunk_info(entry)->addr + pages * PMM_PAGE_SIZE;
+		list_chunk_info(tmp)->npages = list_chunk_info(entry)->npages - pages;
+		list_chunk_info(tmp)->ref = 0;
+		list_chunk_info(tmp)->flag = FF_UNUSED;
+		list_add_after(entry, tmp);
+		avl_insert(&ff_manage->addr_tree, &tmp->addr_node, addr_cmp);
+		free_index_add(ff_manage, tmp);
+		pmm_stat_inc(zone, PMM_STAT_SPLIT);
+	}
+	// 不够的话直接分配
+	list_chunk_info(entry)->npages = pages;
+	list_chunk_info(entry)->ref = 1;
+	list_chunk_info(entry)->flag = FF_USED;
+	ff_manage->phy_page_now_count -= pages;
+	return list_chunk_info(entry)->addr;
+}
 
+void free(ptr_t addr_start, uint32_t bytes __UNUSED__, char zone) {
+	// 首先根据分区找到对应的管理器，然后找到地址对应的管理节点
+	firstfit_manage_t * ff_manage = zone_manage(zone);
+	list_entry_t * entry = (ff_manage == NULL) ? NULL : addr_find(ff_manage, addr_start);
+	if(entry == NULL || list_chunk_info(entry)->flag != FF_USED) {
+		printk_err("Error at firstfit.c: void free(ptr_t)\n");
+		return;
+	}
 	// 释放所有页
+	uint32_t pages = list_chunk_info(entry)->npages;
 	list_chunk_info(entry)->ref = 0;
 	list_chunk_info(entry)->flag = FF_UNUSED;
 
-	// 如果于相邻链表有空闲的则合并
+	// 如果与地址相邻的块也空闲则合并
 	// 后面
-	if(entry->next != entry && list_chunk_info(entry->next)->flag == FF_UNUSED) {
-		list_entry_t * next = entry->next;
+	list_entry_t * next = list_next(entry);
+	if(next != entry && list_chunk_info(next)->flag == FF_UNUSED && chunk_adjacent(entry, next) ) {
+		free_index_del(ff_manage, next);
 		list_chunk_info(entry)->npages += list_chunk_info(next)->npages;
-		list_chunk_info(next)->npages = 0;
+		avl_remove(&ff_manage->addr_tree, &next->addr_node);
 		list_del(next);
+		node_free(ff_manage, next);
+		pmm_stat_inc(zone, PMM_STAT_MERGE);
 	}
 	// 前面
-	if(entry->prev != entry && list_chunk_info(entry->prev)->flag == FF_UNUSED) {
-		list_entry_t * prev = entry->prev;
+	list_entry_t * prev = list_prev(entry);
+	if(prev != entry && list_chunk_info(prev)->flag == FF_UNUSED && chunk_adjacent(prev, entry) ) {
+		free_index_del(ff_manage, prev);
 		list_chunk_info(prev)->npages += list_chunk_info(entry)->npages;
-		list_chunk_info(entry)->npages = 0;
+		avl_remove(&ff_manage->addr_tree, &entry->addr_node);
 		list_del(entry);
+		node_free(ff_manage, entry);
+		entry = prev;
+		pmm_stat_inc(zone, PMM_STAT_MERGE);
 	}
+	free_index_add(ff_manage, entry);
 	ff_manage->phy_page_now_count += pages;
 	return;
 }
 
+// 按地址顺序找第一个包含对齐区间的空闲块，块的头尾剩余部分仍为空闲块
+ptr_t alloc_align(uint32_t bytes, uint32_t align, char zone) {
+	uint32_t pages = (bytes + PMM_PAGE_SIZE - 1) / PMM_PAGE_SIZE;
+	firstfit_manage_t * ff_manage = zone_manage(zone);
+	if(ff_manage == NULL || ff_manage->free_list == NULL || pages == 0
+	    || align < PMM_PAGE_SIZE || (align & (align - 1) ) != 0) {
+		printk_err("Error at firstfit.c: ptr_t alloc_align(uint32_t, uint32_t)\n");
+		return (ptr_t)NULL;
+	}
+	list_entry_t * entry = ff_manage->free_list;
+	ptr_t start = (ptr_t)NULL;
+	do {
+		chunk_info_t * info = list_chunk_info(entry);
+		if(info->flag == FF_UNUSED) {
+			start = (info->addr + align - 1) & ~(align - 1);
+			if(start >= info->addr && start + pages * PMM_PAGE_SIZE <= info->addr + info->npages * PMM_PAGE_SIZE) {
+				break;
+			}
+		}
+		start = (ptr_t)NULL;
+		entry = list_next(entry);
+	} while(entry != ff_manage->free_list);
+	if(start == (ptr_t)NULL) {
+		printk_err("Error at firstfit.c: ptr_t alloc_align(uint32_t, uint32_t)\n");
+		return (ptr_t)NULL;
+	}
+	uint32_t head = (start - list_chunk_info(entry)->addr) / PMM_PAGE_SIZE;
+	uint32_t tail = list_chunk_info(entry)->npages - head - pages;
+	// 先准备好需要的节点，失败时不改变任何状态
+	list_entry_t * used = entry;
+	list_entry_t * rest = (list_entry_t *)NULL;
+	if(head > 0 && (used = node_alloc(ff_manage) ) == NULL) {
+		printk_err("Error at firstfit.c: ptr_t alloc_align(uint32_t, uint32_t)\n");
+		return (ptr_t)NULL;
+	}
+	if(tail > 0 && (rest = node_alloc(ff_manage) ) == NULL) {
+		if(used != entry) {
+			node_free(ff_manage, used);
+		}
+		printk_err("Error at firstfit.c: ptr_t alloc_align(uint32_t, uint32_t)\n");
+		return (ptr_t)NULL;
+	}
+	free_index_del(ff_manage, entry);
+	if(head > 0) {
+		list_chunk_info(entry)->npages = head;
+		free_index_add(ff_manage, entry);
+		list_add_after(entry, used);
+		list_chunk_info(used)->addr = start;
+		avl_insert(&ff_manage->addr_tree, &used->addr_node, addr_cmp);
+		pmm_stat_inc(zone, PMM_STAT_SPLIT);
+	}
+	list_chunk_info(used)->npages = pages;
+	list_chunk_info(used)->ref = 1;
+	list_chunk_info(used)->flag = FF_USED;
+	if(tail > 0) {
+		list_chunk_info(rest)->addr = start + pages * PMM_PAGE_SIZE;
+		list_chunk_info(rest)->npages = tail;
+		list_chunk_info(rest)->ref = 0;
+		list_chunk_info(rest)->flag = FF_UNUSED;
+		list_add_after(used, rest);
+		avl_insert(&ff_manage->addr_tree, &rest->addr_node, addr_cmp);
+		free_index_add(ff_manage, rest);
+		pmm_stat_inc(zone, PMM_STAT_SPLIT);
+	}
+	ff_manage->phy_page_now_count -= pages;
+	return start;
+}
+
+void frag(char zone, pmm_frag_t * frag) {
+	firstfit_manage_t * ff_manage = zone_manage(zone);
+	if(ff_manage == NULL || ff_manage->free_list == NULL) {
+		return;
+	}
+	list_entry_t * entry = ff_manage->free_list;
+	do {
+		if(list_chunk_info(entry)->flag == FF_UNUSED) {
+			frag->blocks[pmm_frag_order(list_chunk_info(entry)->npages)]++;
+			frag->pages[pmm_frag_order(list_chunk_info(entry)->npages)] += list_chunk_info(entry)->npages;
+		}
+		entry = list_next(entry);
+	} while(entry != ff_manage->free_list);
+	return;
+}
+
 uint32_t free_pages_count(char zone) {
-	if(zone==DMA)
-		return ff_manage_dma.phy_page_now_count;
-	else if(zone==NORMAL)
-		return ff_manage_normal.phy_page_now_count;
-	else if(zone==HIGHMEM)
-		return ff_manage_highmem.phy_page_now_count;
-	
+	firstfit_manage_t * ff_manage = zone_manage(zone);
+	if(ff_manage == NULL) {
+		return 0;
+	}
+	return ff_manage->phy_page_now_count;
 }
 
 #ifdef __cplusplus
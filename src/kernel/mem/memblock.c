@@ -0,0 +1,143 @@
+
+// This file is a part of MRNIU/SimpleKernel (https://github.com/MRNIU/SimpleKernel).
+//
+// memblock.c for MRNIU/SimpleKernel.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stdint.h"
+#include "stdio.h"
+#include "string.h"
+#include "mem/vmm.h"
+#include "mem/memblock.h"
+
+// 可用内存
+static memblock_type_t memblock_memory;
+// 已保留的内存
+static memblock_type_t memblock_reserved;
+
+// 插入 [base, base + size)，与相邻或重叠的段合并
+static bool memblock_add(memblock_type_t * type, ptr_t base, uint32_t size);
+
+bool memblock_add(memblock_type_t * type, ptr_t base, uint32_t size) {
+	ptr_t end = base + size;
+	uint32_t i = 0;
+	// 跳过在 base 之前结束的段
+	while(i < type->count && type->region[i].base + type->region[i].size < base) {
+		i++;
+	}
+	// 与之后所有相邻或重叠的段合并为一段
+	uint32_t j = i;
+	while(j < type->count && type->region[j].base <= end) {
+		if(type->region[j].base < base) {
+			base = type->region[j].base;
+		}
+		if(type->region[j].base + type->region[j].size > end) {
+			end = type->region[j].base + type->region[j].size;
+		}
+		j++;
+	}
+	// 没有可以合并的段时后移腾出位置，合并了多段时前移补上空位
+	if(i == j) {
+		if(type->count == MEMBLOCK_MAX) {
+			return false;
+		}
+		for(uint32_t k = type->count ; k > i ; k--) {
+			type->region[k] = type->region[k - 1];
+		}
+		type->count++;
+	}
+	else if(j > i + 1) {
+		for(uint32_t k = j ; k < type->count ; k++) {
+			type->region[k - (j - i - 1)] = type->region[k];
+		}
+		type->count -= j - i - 1;
+	}
+	type->region[i].base = base;
+	type->region[i].size = end - base;
+	return true;
+}
+
+void memblock_init(e820map_t * e820map) {
+	bzero(&memblock_memory, sizeof(memblock_type_t) );
+	bzero(&memblock_reserved, sizeof(memblock_type_t) );
+	for(uint32_t i = 0 ; i < e820map->nr_map ; i++) {
+		// 只使用被映射的部分，按页对齐
+		uint64_t start = (e820map->map[i].addr + PMM_PAGE_SIZE - 1) & PMM_PAGE_MASK;
+		uint64_t end = (e820map->map[i].addr + e820map->map[i].length) & PMM_PAGE_MASK;
+		if(end > PMM_MAX_SIZE) {
+			end = PMM_MAX_SIZE;
+		}
+		if(start < end && !memblock_add(&memblock_memory, (ptr_t)start, (uint32_t)(end - start) ) ) {
+			printk_err("Error at memblock.c: void memblock_init(e820map_t *)\n");
+		}
+	}
+	// 0 号页保留，否则分配出的地址会与 NULL 相同
+	memblock_reserve(0, PMM_PAGE_SIZE);
+	memblock_reserve( (ptr_t)&kernel_init_start, (ptr_t)&kernel_end - KERNEL_BASE - (ptr_t)&kernel_init_start);
+	return;
+}
+
+bool memblock_reserve(ptr_t base, uint32_t size) {
+	ptr_t end = (base + size + PMM_PAGE_SIZE - 1) & PMM_PAGE_MASK;
+	base &= PMM_PAGE_MASK;
+	if(!memblock_add(&memblock_reserved, base, end - base) ) {
+		printk_err("Error at memblock.c: bool memblock_reserve(ptr_t, uint32_t)\n");
+		return false;
+	}
+	return true;
+}
+
+// 按地址顺序找第一个放得下的位置，保留的段按页对齐，所以申请也按页向上取整
+ptr_t memblock_alloc(uint32_t size, uint32_t align) {
+	if(align < PMM_PAGE_SIZE) {
+		align = PMM_PAGE_SIZE;
+	}
+	size = (size + PMM_PAGE_SIZE - 1) & PMM_PAGE_MASK;
+	for(uint32_t i = 0 ; i < memblock_memory.count && size > 0 ; i++) {
+		ptr_t start = memblock_memory.region[i].base;
+		ptr_t end = start + memblock_memory.region[i].size;
+		uint32_t r = 0;
+		while(1) {
+			start = (start + align - 1) & ~(align - 1);
+			if(start < memblock_memory.region[i].base || start + size > end || start + size < start) {
+				break;
+			}
+			// 找到第一个与 [start, start + size) 重叠的保留段
+			while(r < memblock_reserved.count
+			    && memblock_reserved.region[r].base + memblock_reserved.region[r].size <= start) {
+				r++;
+			}
+			if(r == memblock_reserved.count || memblock_reserved.region[r].base >= start + size) {
+				if(!memblock_reserve(start, size) ) {
+					return (ptr_t)NULL;
+				}
+				// 之后会切换到没有恒等映射的页目录，通过线性映射区访问
+				bzero( (void *)VMM_PA_LA(start), size);
+				return VMM_PA_LA(start);
+			}
+			start = memblock_reserved.region[r].base + memblock_reserved.region[r].size;
+		}
+	}
+	printk_err("Error at memblock.c: ptr_t memblock_alloc(uint32_t, uint32_t)\n");
+	return (ptr_t)NULL;
+}
+
+// 保留段很少，顺序查找即可
+bool memblock_is_reserved(ptr_t addr) {
+	for(uint32_t i = 0 ; i < memblock_reserved.count ; i++) {
+		if(addr < memblock_reserved.region[i].base) {
+			return false;
+		}
+		if(addr < memblock_reserved.region[i].base + memblock_reserved.region[i].size) {
+			return true;
+		}
+	}
+	return false;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -12,6 +12,7 @@ extern "C" {
 #include "assert.h"
 #include "mem/pmm.h"
 #include "mem/vmm.h"
+#include "mem/cma.h"
 #include "mem/slab.h"
 
 #define SLAB_USED       (0x00)
@@ -21,16 +22,20 @@ extern "C" {
 #define SLAB_PAGE_COUNT (pmm_free_pages_count() )
 // 最小空间
 #define SLAB_MIN (0xFF)
+// 扩展堆时每次批量申请的页数
+#define SLAB_BULK (16)
 
 static void init(ptr_t addr_start);
 static ptr_t alloc(size_t byte);
 static void free(ptr_t addr);
+static size_t shrink(size_t pages);
 
 heap_manage_t slab_manage = {
 	"Slab",
 	&init,
 	&alloc,
-	&free
+	&free,
+	&shrink
 };
 
 typedef
@@ -69,6 +74,8 @@ typedef
 // 管理信息
 static slab_manage_t sb_manage;
 static list_entry_t * sb_list = NULL;
+// 正在扩展堆，申请物理页时可能触发回收，这时不能归还 alloc() 已经选定的堆尾
+static bool sb_growing = false;
 
 // 初始化节点
 static inline void list_init(list_entry_t * list);
@@ -165,11 +172,10 @@ static inline void set_unused(list_entry_t * entry) {
 void init(ptr_t addr_start) {
 	// 设置第一块内存的信息
 	// 首先给链表中添加一个大小为 1 页的块
-	ptr_t pa = pmm_alloc(VMM_PAGE_SIZE,NORMAL);
+	ptr_t pa = pmm_alloc_flags(VMM_PAGE_SIZE, PMM_KERNEL | PMM_ZERO);
 	ptr_t va = addr_start;
 	// 映射内存
-	map(pgd_kernel, va, pa, VMM_PAGE_PRESENT | VMM_PAGE_RW);
-	bzero( (void *)va, VMM_PAGE_SIZE);
+	map(pgd_kernel, va, pa, VMM_PAGE_PRESENT | VMM_PAGE_RW | VMM_PAGE_GLOBAL);
 	// 解释这段内存
 	sb_list = (list_entry_t *)va;
 	// 填充管理信息
@@ -250,49 +256,81 @@ list_entry_t * find_entry(size_t len) {
 	return (list_entry_t *)NULL;
 }
 
+// 堆中的页被迁移，内容已经复制，改为映射新的物理页
+static bool migrate(ptr_t old_pa __UNUSED__, ptr_t new_pa, void * data);
+bool migrate(ptr_t old_pa __UNUSED__, ptr_t new_pa, void * data) {
+	map(pgd_kernel, (ptr_t)data, new_pa, VMM_PAGE_PRESENT | VMM_PAGE_RW | VMM_PAGE_GLOBAL);
+	return true;
+}
+
+// 归还从 va 开始已经映射的 page 页并取消映射
+static inline void free_page(ptr_t va, size_t page);
+void free_page(ptr_t va, size_t page) {
+	for(size_t i = 0 ; i < page ; i++) {
+		ptr_t pa = (ptr_t)NULL;
+		if(get_mapping(pgd_kernel, va + i * VMM_PAGE_SIZE, &pa) != 0) {
+			pmm_free(pa, VMM_PAGE_SIZE);
+		}
+	}
+	unmap_range(pgd_kernel, va, page);
+	return;
+}
+
 // 申请新的内存页
 // 参数分别为：虚拟地址起点，要申请的页数
+// 物理页不要求连续，这样 shrink() 可以逐页归还，申请到的页已经清零
+// 堆独占 [HEAP_START, HEAP_START + HEAP_MAX_SIZE)，堆尾之后的地址都没有映射，直接从 va 开始映射
 static inline ptr_t alloc_page(ptr_t va, size_t page);
 ptr_t alloc_page(ptr_t va, size_t page) {
-	ptr_t pa = pmm_alloc(page * VMM_PAGE_SIZE,NORMAL);
-	if(pa == (ptr_t)NULL) {
-		printk_err("Error at slab.c ptr_t alloc_page(): no enough physical memory\n");
+	ptr_t start = va;
+	if(start + page * VMM_PAGE_SIZE > HEAP_START + HEAP_MAX_SIZE) {
+		printk_err("Error at slab.c ptr_t alloc_page(): heap is full\n");
 		return (ptr_t)NULL;
 	}
-	for(ptr_t va_start = va, pa_start = pa ;
-	    pa_start < pa + VMM_PAGE_SIZE * page ;
-	    pa_start += VMM_PAGE_SIZE, va_start += VMM_PAGE_SIZE) {
-		// 如果当前线性地址没有映射
-		if(get_mapping(pgd_kernel, va_start, (ptr_t *)NULL) == 0) {
-			map(pgd_kernel, va_start, pa_start, VMM_PAGE_PRESENT | VMM_PAGE_RW);
+	ptr_t frames[SLAB_BULK];
+	size_t mapped = 0;
+	while(mapped < page) {
+		size_t n = (page - mapped > SLAB_BULK) ? SLAB_BULK : page - mapped;
+		size_t got = 0;
+		// 单页从清零页池取，内存不足时可以借用连续内存区域，多页批量申请后统一清零
+		if(n == 1) {
+			frames[0] = cma_alloc_movable(PMM_KERNEL | PMM_ZERO, &migrate, (void *)(start + mapped * VMM_PAGE_SIZE) );
+			got = (frames[0] != (ptr_t)NULL) ? 1 : 0;
 		}
 		else {
-			// 如果有部分映射了，则全部 unmap
-			ptr_t addr = (ptr_t)NULL;
-			for(addr = va ; addr < va_start ; addr += VMM_PAGE_SIZE) {
-				unmap(pgd_kernel, addr);
+			got = pmm_alloc_bulk(NORMAL, n, frames);
+			// NORMAL 不够时逐页从其它分区申请
+			while(got < n && (frames[got] = pmm_alloc_flags(VMM_PAGE_SIZE, PMM_KERNEL) ) != (ptr_t)NULL) {
+				got++;
 			}
-			// 并重新计算 va 的值
-			// 运行到这里时 addr 尚未被检测，所以下面的代码从 addr 开始
-			// 计算方法：addr~addr+page*VMM_PAGE_SIZE 的 get_mapping 结果全部为 0
-			ptr_t tmp = addr;
-			while(addr < tmp + page * VMM_PAGE_SIZE) {
-				// 如果遇到映射过的
-				if(get_mapping(pgd_kernel, addr, (ptr_t *)NULL) != 0) {
-					// 更新 addr 地址
-					addr += VMM_PAGE_SIZE;
-					tmp = addr;
-				}
-				addr += VMM_PAGE_SIZE;
+		}
+		if(got < n) {
+			printk_err("Error at slab.c ptr_t alloc_page(): no enough physical memory\n");
+			pmm_free_bulk(got, frames);
+			// 归还已经映射的页
+			free_page(start, mapped);
+			return (ptr_t)NULL;
+		}
+		// 物理地址连续的页一次映射，页表申请失败时只映射了一部分
+		size_t done = 0;
+		for(size_t i = 0, j = 1 ; i < n && done == i ; i = j++) {
+			while(j < n && frames[j] == frames[j - 1] + VMM_PAGE_SIZE) {
+				j++;
 			}
-			// 这时 addr 就是符合要求的地址
-			// 全部映射即可
-			map(pgd_kernel, addr, pa_start, VMM_PAGE_PRESENT | VMM_PAGE_RW);
-			return addr;
+			done += map_range(pgd_kernel, start + (mapped + i) * VMM_PAGE_SIZE, frames[i], j - i, VMM_PAGE_PRESENT | VMM_PAGE_RW | VMM_PAGE_GLOBAL);
+		}
+		if(done < n) {
+			printk_err("Error at slab.c ptr_t alloc_page(): map failed\n");
+			pmm_free_bulk(n - done, frames + done);
+			free_page(start, mapped + done);
+			return (ptr_t)NULL;
 		}
+		if(n > 1) {
+			bzero( (void *)(start + mapped * VMM_PAGE_SIZE), n * VMM_PAGE_SIZE);
+		}
+		mapped += n;
 	}
-	bzero( (void *)va, VMM_PAGE_SIZE * page);
-	return va;
+	return start;
 }
 
 ptr_t alloc(size_t byte) {
@@ -308,7 +346,9 @@ ptr_t alloc(size_t byte) {
 	list_entry_t * new_entry;
 	len += sizeof(list_entry_t);
 	size_t pages = (len % VMM_PAGE_SIZE == 0) ? (len / VMM_PAGE_SIZE) : ( (len / VMM_PAGE_SIZE) + 1);
+	sb_growing = true;
 	ptr_t va = alloc_page( (ptr_t)( (ptr_t)entry + sizeof(list_entry_t) + list_slab_block(entry)->len), pages);
+	sb_growing = false;
 	if(va == (ptr_t)NULL) {
 		printk_err("Error at slab.c ptr_t alloc_align(): no enough physical memory\n");
 		return (ptr_t)NULL;
@@ -336,6 +376,31 @@ void free(ptr_t addr) {
 	return;
 }
 
+// 堆尾部的空闲块中，保留头与最小空间后的整页可以归还
+size_t shrink(size_t pages) {
+	list_entry_t * entry = list_prev(sb_manage.slab_list);
+	if(sb_growing || list_slab_block(entry)->allocated != SLAB_UNUSED) {
+		return 0;
+	}
+	ptr_t start = (ptr_t)entry + sizeof(list_entry_t);
+	ptr_t end = (start + list_slab_block(entry)->len) & VMM_PAGE_MASK;
+	ptr_t keep = (start + SLAB_MIN + VMM_PAGE_SIZE - 1) & VMM_PAGE_MASK;
+	size_t count = 0;
+	// 从高地址开始归还
+	while(count < pages && end > keep) {
+		ptr_t pa = (ptr_t)NULL;
+		end -= VMM_PAGE_SIZE;
+		get_mapping(pgd_kernel, end, &pa);
+		pmm_free(pa, VMM_PAGE_SIZE);
+		count++;
+	}
+	if(count > 0) {
+		unmap_range(pgd_kernel, end, count);
+		list_slab_block(entry)->len = end - start;
+	}
+	return count;
+}
+
 #ifdef __cplusplus
 }
 #endif
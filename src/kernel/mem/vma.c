@@ -0,0 +1,276 @@
+
+// This file is a part of MRNIU/SimpleKernel (https://github.com/MRNIU/SimpleKernel).
+//
+// vma.c for MRNIU/SimpleKernel.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stdint.h"
+#include "stdio.h"
+#include "string.h"
+#include "heap/heap.h"
+#include "mem/vma.h"
+
+// 空节点返回 NULL
+static inline vma_t * vma_entry(avl_node_t * node) {
+	return (node == NULL) ? NULL : avl_entry(node, vma_t, node);
+}
+
+static inline size_t vma_max_size(avl_node_t * node) {
+	return (node == NULL) ? 0 : vma_entry(node)->max_size;
+}
+
+// 按起始地址排序
+static int vma_compare(avl_node_t * node1, avl_node_t * node2);
+// 树的更新函数，子树变化后重新计算最长区域的长度
+static void vma_update(avl_node_t * node);
+// 申请一个 [start, end) 的节点
+static vma_t * vma_node_alloc(ptr_t start, ptr_t end, uint32_t flags);
+static void vma_node_destroy(avl_node_t * node);
+static avl_node_t * vma_node_copy(avl_node_t * node, avl_node_t * parent);
+// 从树中删除并释放 vma
+static void vma_delete(vma_set_t * set, vma_t * vma);
+// 起始地址小于 addr 的最后一个区域
+static vma_t * vma_find_prev(vma_set_t * set, ptr_t addr);
+
+int vma_compare(avl_node_t * node1, avl_node_t * node2) {
+	ptr_t start1 = vma_entry(node1)->start;
+	ptr_t start2 = vma_entry(node2)->start;
+	return (start1 < start2) ? -1 : (start1 > start2) ? 1 : 0;
+}
+
+void vma_update(avl_node_t * node) {
+	vma_t * vma = vma_entry(node);
+	vma->max_size = vma->end - vma->start;
+	if(vma_max_size(node->left) > vma->max_size) {
+		vma->max_size = vma_max_size(node->left);
+	}
+	if(vma_max_size(node->right) > vma->max_size) {
+		vma->max_size = vma_max_size(node->right);
+	}
+	return;
+}
+
+vma_t * vma_node_alloc(ptr_t start, ptr_t end, uint32_t flags) {
+	vma_t * vma = (vma_t *)kmalloc(sizeof(vma_t) );
+	if(vma == NULL) {
+		return NULL;
+	}
+	vma->start = start;
+	vma->end = end;
+	vma->flags = flags;
+	vma->max_size = end - start;
+	return vma;
+}
+
+void vma_node_destroy(avl_node_t * node) {
+	if(node == NULL) {
+		return;
+	}
+	vma_node_destroy(node->left);
+	vma_node_destroy(node->right);
+	kfree( (ptr_t)vma_entry(node) );
+	return;
+}
+
+// 保持原来的形状，不需要重新平衡
+avl_node_t * vma_node_copy(avl_node_t * node, avl_node_t * parent) {
+	if(node == NULL) {
+		return NULL;
+	}
+	vma_t * copy = (vma_t *)kmalloc(sizeof(vma_t) );
+	if(copy == NULL) {
+		return NULL;
+	}
+	memcpy(copy, vma_entry(node), sizeof(vma_t) );
+	copy->node.left = NULL;
+	copy->node.right = NULL;
+	copy->node.parent = parent;
+	if( (node->left != NULL && (copy->node.left = vma_node_copy(node->left, &copy->node) ) == NULL)
+	    || (node->right != NULL && (copy->node.right = vma_node_copy(node->right, &copy->node) ) == NULL) ) {
+		vma_node_destroy(&copy->node);
+		return NULL;
+	}
+	return &copy->node;
+}
+
+void vma_delete(vma_set_t * set, vma_t * vma) {
+	avl_remove(&set->root, &vma->node);
+	if(set->cache == vma) {
+		set->cache = NULL;
+	}
+	set->count--;
+	kfree( (ptr_t)vma);
+	return;
+}
+
+vma_t * vma_find_prev(vma_set_t * set, ptr_t addr) {
+	vma_t * prev = NULL;
+	avl_node_t * node = set->root.node;
+	while(node != NULL) {
+		if(vma_entry(node)->start < addr) {
+			prev = vma_entry(node);
+			node = node->right;
+		}
+		else {
+			node = node->left;
+		}
+	}
+	return prev;
+}
+
+void vma_set_init(vma_set_t * set) {
+	avl_init_root_augmented(&set->root, &vma_update);
+	set->cache = NULL;
+	set->count = 0;
+	return;
+}
+
+void vma_set_destroy(vma_set_t * set) {
+	vma_node_destroy(set->root.node);
+	vma_set_init(set);
+	return;
+}
+
+bool vma_set_copy(vma_set_t * dst, vma_set_t * src) {
+	vma_set_init(dst);
+	dst->root.node = vma_node_copy(src->root.node, NULL);
+	if(src->root.node != NULL && dst->root.node == NULL) {
+		printk_err("Error at vma.c: bool vma_set_copy(vma_set_t *, vma_set_t *)\n");
+		return false;
+	}
+	dst->count = src->count;
+	return true;
+}
+
+// 区域互不重叠，按起始地址排序时结束地址也是有序的
+vma_t * vma_find_next(vma_set_t * set, ptr_t addr) {
+	vma_t * next = NULL;
+	avl_node_t * node = set->root.node;
+	while(node != NULL) {
+		if(vma_entry(node)->end > addr) {
+			next = vma_entry(node);
+			node = node->left;
+		}
+		else {
+			node = node->right;
+		}
+	}
+	return next;
+}
+
+// 左子树中有足够长的区域时优先向左，得到的是地址最低的
+vma_t * vma_find_size(vma_set_t * set, size_t size) {
+	avl_node_t * node = set->root.node;
+	if(vma_max_size(node) < size) {
+		return NULL;
+	}
+	while(node != NULL) {
+		if(vma_max_size(node->left) >= size) {
+			node = node->left;
+		}
+		else if(vma_entry(node)->end - vma_entry(node)->start >= size) {
+			return vma_entry(node);
+		}
+		else {
+			node = node->right;
+		}
+	}
+	return NULL;
+}
+
+vma_t * vma_find(vma_set_t * set, ptr_t addr) {
+	vma_t * vma = set->cache;
+	if(vma != NULL && addr >= vma->start && addr < vma->end) {
+		return vma;
+	}
+	vma = vma_find_next(set, addr);
+	if(vma == NULL || addr < vma->start) {
+		return NULL;
+	}
+	set->cache = vma;
+	return vma;
+}
+
+// 合并只修改相邻区域的起止地址，不改变它们在树中的顺序，只需要更新路径上的子树信息
+vma_t * vma_insert(vma_set_t * set, ptr_t start, ptr_t end, uint32_t flags) {
+	if(start >= end) {
+		printk_err("Error at vma.c: vma_t * vma_insert(vma_set_t *, ptr_t, ptr_t, uint32_t)\n");
+		return NULL;
+	}
+	vma_t * next = vma_find_next(set, start);
+	if(next != NULL && next->start < end) {
+		printk_err("Error at vma.c: vma_t * vma_insert(vma_set_t *, ptr_t, ptr_t, uint32_t)\n");
+		return NULL;
+	}
+	vma_t * prev = vma_find_prev(set, start);
+	bool merge_prev = (prev != NULL && prev->end == start && prev->flags == flags);
+	bool merge_next = (next != NULL && next->start == end && next->flags == flags);
+	if(merge_prev && merge_next) {
+		prev->end = next->end;
+		vma_delete(set, next);
+		avl_propagate(&set->root, &prev->node);
+		return prev;
+	}
+	if(merge_prev) {
+		prev->end = end;
+		avl_propagate(&set->root, &prev->node);
+		return prev;
+	}
+	if(merge_next) {
+		next->start = start;
+		avl_propagate(&set->root, &next->node);
+		return next;
+	}
+	vma_t * vma = vma_node_alloc(start, end, flags);
+	if(vma == NULL) {
+		printk_err("Error at vma.c: vma_t * vma_insert(vma_set_t *, ptr_t, ptr_t, uint32_t)\n");
+		return NULL;
+	}
+	avl_insert(&set->root, &vma->node, &vma_compare);
+	set->count++;
+	return vma;
+}
+
+vma_t * vma_split(vma_set_t * set, vma_t * vma, ptr_t addr) {
+	if(addr <= vma->start || addr >= vma->end) {
+		printk_err("Error at vma.c: vma_t * vma_split(vma_set_t *, vma_t *, ptr_t)\n");
+		return NULL;
+	}
+	vma_t * tail = vma_node_alloc(addr, vma->end, vma->flags);
+	if(tail == NULL) {
+		printk_err("Error at vma.c: vma_t * vma_split(vma_set_t *, vma_t *, ptr_t)\n");
+		return NULL;
+	}
+	vma->end = addr;
+	avl_insert(&set->root, &tail->node, &vma_compare);
+	avl_propagate(&set->root, &vma->node);
+	set->count++;
+	return tail;
+}
+
+size_t vma_remove(vma_set_t * set, ptr_t start, ptr_t end) {
+	size_t bytes = 0;
+	vma_t * vma = NULL;
+	while( (vma = vma_find_next(set, start) ) != NULL && vma->start < end) {
+		// 只删除 [start, end) 中的部分
+		if(vma->start < start) {
+			vma = vma_split(set, vma, start);
+			if(vma == NULL) {
+				break;
+			}
+		}
+		if(vma->end > end && vma_split(set, vma, end) == NULL) {
+			break;
+		}
+		bytes += vma->end - vma->start;
+		vma_delete(set, vma);
+	}
+	return bytes;
+}
+
+#ifdef __cplusplus
+}
+#endif
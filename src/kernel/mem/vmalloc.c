@@ -0,0 +1,142 @@
+
+// This file is a part of MRNIU/SimpleKernel (https://github.com/MRNIU/SimpleKernel).
+//
+// vmalloc.c for MRNIU/SimpleKernel.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "stdint.h"
+#include "stdio.h"
+#include "sync.hpp"
+#include "mem/pmm.h"
+#include "mem/vmm.h"
+#include "mem/vma.h"
+#include "mem/vmalloc.h"
+
+// 每段之后不映射的页数
+#define VMALLOC_GUARD       (1)
+// 每次批量申请的物理页数
+#define VMALLOC_BULK        (16)
+
+// 空闲的地址段
+static vma_set_t vmalloc_free;
+
+// 取出 size 字节的地址，没有时返回 NULL
+static ptr_t vmalloc_area_get(size_t size);
+// 归还地址
+static void vmalloc_area_put(ptr_t addr, size_t size);
+// 取消 [addr, addr + pages * VMM_PAGE_SIZE) 的映射并释放物理页
+static void vmalloc_unmap(ptr_t addr, size_t pages);
+
+void vmalloc_init(void) {
+	vma_set_init(&vmalloc_free);
+	// 之后复制的页目录与 pgd_kernel 共享这些页目录项，可以看到之后建立的映射
+	if(!vmm_prealloc_pte(pgd_kernel, VMALLOC_START, VMALLOC_END)
+	    || vma_insert(&vmalloc_free, VMALLOC_START, VMALLOC_END, 0) == NULL) {
+		printk_err("Error at vmalloc.c: void vmalloc_init(void)\n");
+		return;
+	}
+	printk_info("vmalloc_init: 0x%08X-0x%08X\n", VMALLOC_START, VMALLOC_END);
+	return;
+}
+
+// 从地址最低的足够长的空闲段头部取
+ptr_t vmalloc_area_get(size_t size) {
+	vma_t * vma = vma_find_size(&vmalloc_free, size);
+	if(vma == NULL) {
+		return (ptr_t)NULL;
+	}
+	ptr_t addr = vma->start;
+	if(vma_remove(&vmalloc_free, addr, addr + size) != size) {
+		return (ptr_t)NULL;
+	}
+	return addr;
+}
+
+// 与相邻的空闲段合并
+void vmalloc_area_put(ptr_t addr, size_t size) {
+	if(vma_insert(&vmalloc_free, addr, addr + size, 0) == NULL) {
+		printk_err("Error at vmalloc.c: void vmalloc_area_put(ptr_t, size_t)\n");
+	}
+	return;
+}
+
+void vmalloc_unmap(ptr_t addr, size_t pages) {
+	for(size_t i = 0 ; i < pages ; i++) {
+		ptr_t pa = (ptr_t)NULL;
+		if(get_mapping(pgd_kernel, addr + i * VMM_PAGE_SIZE, &pa) != 0) {
+			pmm_free(pa, VMM_PAGE_SIZE);
+		}
+	}
+	unmap_range(pgd_kernel, addr, pages);
+	return;
+}
+
+ptr_t vmalloc(size_t byte) {
+	size_t pages = (byte + VMM_PAGE_SIZE - 1) / VMM_PAGE_SIZE;
+	if(pages == 0) {
+		return (ptr_t)NULL;
+	}
+	ptr_t addr = (ptr_t)NULL;
+	bool intr_flag = false;
+	local_intr_store(intr_flag);
+	{
+		addr = vmalloc_area_get( (pages + VMALLOC_GUARD) * VMM_PAGE_SIZE);
+		ptr_t frames[VMALLOC_BULK];
+		size_t mapped = 0;
+		while(addr != (ptr_t)NULL && mapped < pages) {
+			size_t n = (pages - mapped > VMALLOC_BULK) ? VMALLOC_BULK : pages - mapped;
+			size_t got = pmm_alloc_bulk(NORMAL, n, frames);
+			// NORMAL 不够时逐页从其它分区申请
+			while(got < n && (frames[got] = pmm_alloc_flags(VMM_PAGE_SIZE, PMM_KERNEL) ) != (ptr_t)NULL) {
+				got++;
+			}
+			size_t done = 0;
+			if(got == n) {
+				// 物理地址连续的页一次映射，页表申请失败时只映射了一部分
+				for(size_t i = 0, j = 1 ; i < n && done == i ; i = j++) {
+					while(j < n && frames[j] == frames[j - 1] + VMM_PAGE_SIZE) {
+						j++;
+					}
+					done += map_range(pgd_kernel, addr + (mapped + i) * VMM_PAGE_SIZE, frames[i], j - i, VMM_PAGE_PRESENT | VMM_PAGE_RW | VMM_PAGE_GLOBAL);
+				}
+			}
+			mapped += done;
+			// 归还没有映射的页，再归还已经映射的部分
+			if(done < n) {
+				pmm_free_bulk(got - done, frames + done);
+				vmalloc_unmap(addr, mapped);
+				vmalloc_area_put(addr, (pages + VMALLOC_GUARD) * VMM_PAGE_SIZE);
+				addr = (ptr_t)NULL;
+				break;
+			}
+		}
+	}
+	local_intr_restore(intr_flag);
+	if(addr == (ptr_t)NULL) {
+		printk_err("Error at vmalloc.c: ptr_t vmalloc(size_t)\n");
+	}
+	return addr;
+}
+
+void vfree(ptr_t addr, size_t byte) {
+	size_t pages = (byte + VMM_PAGE_SIZE - 1) / VMM_PAGE_SIZE;
+	if(addr < VMALLOC_START || addr + (pages + VMALLOC_GUARD) * VMM_PAGE_SIZE > VMALLOC_END || (addr & ~VMM_PAGE_MASK) ) {
+		printk_err("Error at vmalloc.c: void vfree(ptr_t, size_t)\n");
+		return;
+	}
+	bool intr_flag = false;
+	local_intr_store(intr_flag);
+	{
+		vmalloc_unmap(addr, pages);
+		vmalloc_area_put(addr, (pages + VMALLOC_GUARD) * VMM_PAGE_SIZE);
+	}
+	local_intr_restore(intr_flag);
+	return;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -9,9 +9,14 @@ extern "C" {
 
 #include "stdio.h"
 #include "stdint.h"
+#include "string.h"
 #include "debug.h"
+#include "sync.hpp"
 #include "mem/pmm.h"
 #include "mem/vmm.h"
+#include "mem/cma.h"
+#include "mem/vma.h"
+#include "mem/vmalloc.h"
 #include "../drv/clock/include/clock.h"
 #include "../drv/keyboard/include/keyboard.h"
 #include "heap/heap.h"
@@ -35,13 +40,103 @@ bool test_pmm(void) {
 	allc_addr = pmm_alloc(1,DMA);
 	printk_test("Alloc Physical Addr: 0x%08X\n", allc_addr);
 	printk_test("Free pages count: %d\n", pmm_free_pages_count(DMA) );
+	allc_addr = pmm_alloc_flags(9000, PMM_KERNEL);
+	printk_test("Alloc Physical Addr: 0x%08X, zone: %d\n", allc_addr, page_zone(addr_page(allc_addr) ) );
+	pmm_free(allc_addr, 9000);
+	printk_test("Free!\n");
+	allc_addr = pmm_alloc_flags(1, PMM_KERNEL);
+	page_get(addr_page(allc_addr) );
+	printk_test("Page ref: %d\n", page_ref(addr_page(allc_addr) ) );
+	page_put(addr_page(allc_addr) );
+	page_put(addr_page(allc_addr) );
+	printk_test("Page ref after put: %d\n", page_ref(addr_page(allc_addr) ) );
+	allc_addr = pmm_alloc_large(PMM_KERNEL);
+	printk_test("Alloc Large Physical Addr: 0x%08X\n", allc_addr);
+	pmm_free_large(allc_addr);
+	printk_test("Free!\n");
+	allc_addr = cma_alloc(0x10000);
+	printk_test("CMA Alloc Physical Addr: 0x%08X, free: %d\n", allc_addr, cma_free_pages_count() );
+	cma_free(allc_addr, 0x10000);
+	printk_test("CMA Page ref after free: %d\n", page_ref(addr_page(allc_addr) ) );
+	printk_test("Free!\n");
+	pmm_stat_print();
 	return true;
 }
 
-bool test_vmm(void) {
+// 缺页处理使用当前任务的地址空间，这里借用一个临时任务
+static bool test_vmm_fault(void) {
+	const ptr_t va = 0x40000000;
+	task_pcb_t task;
+	task_mem_t mm;
+	bzero(&task, sizeof(task_pcb_t) );
+	bzero(&mm, sizeof(task_mem_t) );
+	task.mm = &mm;
+	mm.pgd_dir = vmm_copy_pgd(pgd_kernel);
+	if(mm.pgd_dir == NULL) {
+		return false;
+	}
+	vma_set_init(&mm.vma);
+	vma_insert(&mm.vma, va, va + VMM_PAGE_SIZE, VMA_READ | VMA_WRITE | VMA_ANON);
+	printk_test("Test Page Fault :\n");
+	task_pcb_t * task_saved = curr_task;
+	bool intr_flag = false;
+	local_intr_store(intr_flag);
+	{
+		curr_task = &task;
+		switch_pgd(VMM_LA_PA( (ptr_t)mm.pgd_dir) );
+		// 第一次访问时分配清零的页
+		printk_test("Demand page value: 0x%08X\n", *(volatile uint32_t *)va);
+		*(volatile uint32_t *)va = 0x55;
+		// 复制后两个页目录只读共享同一页，写入时才复制
+		pgd_t * pgd_child = vmm_copy_pgd(mm.pgd_dir);
+		ptr_t pa = (ptr_t)NULL;
+		ptr_t child_pa = (ptr_t)NULL;
+		if(pgd_child != NULL) {
+			get_mapping(mm.pgd_dir, va, &pa);
+			printk_test("COW page ref: %d\n", page_ref(addr_page(pa) ) );
+			*(volatile uint32_t *)va = 0xAA;
+			get_mapping(mm.pgd_dir, va, &pa);
+			get_mapping(pgd_child, va, &child_pa);
+			printk_test("COW parent: 0x%08X, child: 0x%08X, child value: 0x%08X\n", pa, child_pa, *(uint32_t *)VMM_PA_LA(child_pa) );
+			vmm_free_pgd(pgd_child);
+		}
+		// 同一页表中先映射只读页，再映射可写页，写入后者不应出错
+		// 物理页在释放页目录时归还
+		const ptr_t va_ro = va + VMM_PAGE_TABLE_SIZE;
+		map(mm.pgd_dir, va_ro, pmm_alloc_flags(VMM_PAGE_SIZE, PMM_KERNEL), VMM_PAGE_PRESENT);
+		map(mm.pgd_dir, va_ro + VMM_PAGE_SIZE, pmm_alloc_flags(VMM_PAGE_SIZE, PMM_KERNEL), VMM_PAGE_PRESENT | VMM_PAGE_RW);
+		*(volatile uint32_t *)(va_ro + VMM_PAGE_SIZE) = 0x55;
+		printk_test("Write after read-only map: 0x%08X\n", *(volatile uint32_t *)(va_ro + VMM_PAGE_SIZE) );
+		switch_pgd(VMM_LA_PA( (ptr_t)pgd_kernel) );
+		curr_task = task_saved;
+	}
+	local_intr_restore(intr_flag);
+	vmm_free_pgd(mm.pgd_dir);
+	vma_set_destroy(&mm.vma);
 	return true;
 }
 
+bool test_vmm(void) {
+	vma_set_t set;
+	vma_set_init(&set);
+	printk_test("Test VMA :\n");
+	// 相邻且属性相同的区域合并为一个
+	vma_insert(&set, 0x1000, 0x3000, VMA_READ | VMA_WRITE | VMA_ANON);
+	vma_insert(&set, 0x5000, 0x8000, VMA_READ | VMA_WRITE | VMA_ANON);
+	vma_insert(&set, 0x3000, 0x5000, VMA_READ | VMA_WRITE | VMA_ANON);
+	printk_test("VMA count after merge: %d\n", set.count);
+	// 重叠的区域不能添加
+	printk_test("VMA overlap insert: 0x%08X\n", vma_insert(&set, 0x2000, 0x4000, VMA_READ) );
+	// 中间删除一段后分为两个
+	vma_remove(&set, 0x4000, 0x6000);
+	printk_test("VMA count after remove: %d\n", set.count);
+	vma_t * vma = vma_find(&set, 0x6000);
+	printk_test("VMA find 0x6000: 0x%08X-0x%08X\n", vma->start, vma->end);
+	printk_test("VMA find 0x4000: 0x%08X\n", vma_find(&set, 0x4000) );
+	vma_set_destroy(&set);
+	return test_vmm_fault();
+}
+
 bool test_libc(void) {
 	return true;
 }
@@ -109,14 +204,31 @@ bool test_heap(void) {
 	kfree( (ptr_t)allc_addr4);
 	ptr_t new_addr = (ptr_t)kmalloc(9000);
 	printk_test("New kmalloc heap addr: 0x%08X\n", new_addr);
+	// 之前复制的页目录与内核共享页表，同样可以看到之后的映射
+	pgd_t * pgd_copy = vmm_copy_pgd(pgd_kernel);
+	ptr_t vm_addr1 = vmalloc(0x20000);
+	printk_test("vmalloc addr: 0x%08X\n", vm_addr1);
+	if(pgd_copy != NULL) {
+		printk_test("vmalloc mapped in copied pgd: %d\n", get_mapping(pgd_copy, vm_addr1, NULL) );
+		vmm_free_pgd(pgd_copy);
+	}
+	ptr_t vm_addr2 = vmalloc(1);
+	printk_test("vmalloc addr: 0x%08X\n", vm_addr2);
+	vfree(vm_addr1, 0x20000);
+	printk_test("vfree: 0x%08X\n", vm_addr1);
+	// 释放的地址段可以再次使用
+	ptr_t vm_addr3 = vmalloc(0x1000);
+	printk_test("vmalloc addr: 0x%08X\n", vm_addr3);
+	vfree(vm_addr2, 1);
+	vfree(vm_addr3, 0x1000);
 	return true;
 }
 
 bool test(void) {
 	 test_pmm();
-	// test_vmm();
+	test_vmm();
 	// test_libc();
-	// test_heap();
+	test_heap();
 	//test_task();
 	// test_sched();
 	return true;